@@ -1,5 +1,22 @@
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/stat.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <endian.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include <iostream>
 #include <stdint.h>
@@ -11,23 +28,126 @@
 #include <map>
 #include <algorithm>
 #include <iterator>
+#include <utility>
+#include <cstring>
+#include <cstddef>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <optional>
+#include <memory>
+#include <array>
+#include <ctime>
+#include <cmath>
+#include <new>
+#include <cstdlib>
 
 #ifdef USING_WIRING_PI
 #include <wiringPi.h>
 #endif
+#ifdef USING_LIBGPIOD
+#include <gpiod.h>
+#endif
+
+// usbmon binary api, see drivers/usb/mon/mon_bin.c (not part of the uapi headers)
+#define MON_IOC_MAGIC      0x92
+#define MON_IOCG_STATS     _IOR(MON_IOC_MAGIC, 3, struct mon_bin_stats)
+#define MON_IOCT_RING_SIZE _IO(MON_IOC_MAGIC, 4)
+#define MON_IOCQ_RING_SIZE _IO(MON_IOC_MAGIC, 5)
+#define MON_IOCX_MFETCH    _IOWR(MON_IOC_MAGIC, 7, struct mon_bin_mfetch)
+#define MON_IOCH_MFLUSH    _IO(MON_IOC_MAGIC, 8)
+
+struct mon_bin_stats {
+    uint32_t queued;    // events waiting in the ring
+    uint32_t dropped;   // events lost since the last query, reset by the query
+};
+
+struct mon_bin_mfetch {
+    uint32_t *offvec;   // vector of events fetched
+    uint32_t  nfetch;   // number of events to fetch (out: fetched)
+    uint32_t  nflush;   // number of events to flush
+};
+
+// event header of the binary api, read in place from the mapped ring (events are 64 byte aligned)
+struct mon_bin_hdr {
+    uint64_t      id;           // urb id, a submission and its callback share it
+    unsigned char type;         // 'S' submission, 'C' callback, 'E' error, '@' ring filler
+    unsigned char xfer_type;    // 0 iso, 1 interrupt, 2 control, 3 bulk
+    unsigned char epnum;        // endpoint, 0x80 set for in
+    unsigned char devnum;
+    uint16_t      busnum;
+    char          flag_setup;
+    char          flag_data;
+    int64_t       ts_sec;
+    int32_t       ts_usec;
+    int32_t       status;
+    uint32_t      len_urb;      // transfer length, the actual length of a callback
+    uint32_t      len_cap;      // captured data after the header
+    unsigned char setup[8];     // setup packet, or the iso error count and descriptor count
+    int32_t       interval;
+    int32_t       start_frame;
+    uint32_t      xfer_flags;
+    uint32_t      ndesc;
+};
+static_assert(sizeof(mon_bin_hdr) == 64, "usbmon header layout");
+static_assert(offsetof(mon_bin_hdr, type) == 8 && offsetof(mon_bin_hdr, xfer_type) == 9, "usbmon header layout");
+static_assert(offsetof(mon_bin_hdr, epnum) == 10 && offsetof(mon_bin_hdr, devnum) == 11, "usbmon header layout");
+static_assert(offsetof(mon_bin_hdr, busnum) == 12 && offsetof(mon_bin_hdr, ts_sec) == 16, "usbmon header layout");
+static_assert(offsetof(mon_bin_hdr, status) == 28 && offsetof(mon_bin_hdr, len_urb) == 32, "usbmon header layout");
+static_assert(offsetof(mon_bin_hdr, setup) == 40 && offsetof(mon_bin_hdr, ndesc) == 60, "usbmon header layout");
+
+// record of the trace file (-record), the parsed fields of an event. the type and the status are folded
+// into the counted length, so the replay counts exactly what the capture counted
+struct trace_record {
+    int64_t       ts_us;        // event timestamp in microseconds
+    uint32_t      len_urb;      // counted bytes, 0 for submissions, errors and ring fillers
+    unsigned char busnum;
+    unsigned char devnum;
+    unsigned char epnum;        // endpoint, 0x80 set for in
+    unsigned char xfer_type;
+};
+static_assert(sizeof(trace_record) == 16, "trace record layout");
+
+// the trace file starts with this header, the records follow and can be mapped in place
+struct trace_header {
+    char     magic[8];          // "USBLTRC1"
+    uint32_t record_size;
+    uint32_t reserved;
+};
+static_assert(sizeof(trace_header) == 16, "trace header layout");
+constexpr char trace_magic[8] = { 'U', 'S', 'B', 'L', 'T', 'R', 'C', '1' };
 
 using namespace std;
 using namespace std::string_view_literals;
 using namespace std::chrono_literals;
 
-using duration_t  = chrono::milliseconds;
-using timepoint_t = chrono::high_resolution_clock::time_point;
+// microseconds give a 100 ms period 100000 brightness levels
+using duration_t  = chrono::microseconds;
+using timepoint_t = chrono::steady_clock::time_point;
 using seconds_t   = chrono::duration<double, ratio<1, 1>>;
 using arguments_t = vector<string_view>;
 
 // get the current timepoint
 timepoint_t now() noexcept {
-    return chrono::high_resolution_clock::now();
+    return chrono::steady_clock::now();
+}
+
+// nanoseconds of the raw monotonic clock, not slewed by ntp, to time the syscalls of the capture thread
+int64_t raw_ns() noexcept {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// tell the core that the thread spins, frees the pipeline for a sibling thread and saves power
+inline void cpu_relax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield" ::: "memory");
+#else
+    atomic_signal_fence(memory_order_seq_cst);
+#endif
 }
 
 // cvt any duration to seconds
@@ -42,30 +162,207 @@ T multiply_duration(T const &d, double ratio) noexcept {
     return T(static_cast<typename T::rep>(d.count() * ratio));
 } 
 
-timeval get_timeval_until(timepoint_t const &tp) {
-    auto remaining = tp - now();
-    auto remaining_s  = chrono::duration_cast<chrono::seconds>(remaining);
-    auto remianing_us = chrono::duration_cast<chrono::microseconds>(remaining) 
-        - chrono::duration_cast<chrono::microseconds>(remaining_s);
+// cvt a timepoint to an absolute CLOCK_MONOTONIC timespec (the steady_clock epoch)
+timespec to_timespec(timepoint_t const &tp) noexcept {
+    auto since_epoch = chrono::duration_cast<chrono::nanoseconds>(tp.time_since_epoch());
+    auto secs        = chrono::duration_cast<chrono::seconds>(since_epoch);
+    timespec ts;
+    ts.tv_sec  = secs.count();
+    ts.tv_nsec = (since_epoch - secs).count();
+    return ts;
+}
+
+// pin a thread to the given cpu, a negative cpu keeps the default affinity
+void pin_to_cpu(pthread_t thread, int cpu) {
+    if (cpu < 0)
+        return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(thread, sizeof(set), &set) != 0) {
+        cerr << "Cannot pin thread to cpu " << cpu << "!\n";
+        exit(-1);
+    }
+}
+
+// heap allocations of the calling thread, counted by the global operator new below. the hot loops
+// of the pwm and the capture thread check that they do not allocate after their setup
+thread_local uint64_t thread_allocations = 0;
+
+void *operator new(size_t size) {
+    ++thread_allocations;
+    if (void *p = malloc(size != 0 ? size : 1))
+        return p;
+    throw bad_alloc{};
+}
+void *operator new(size_t size, align_val_t alignment) {
+    ++thread_allocations;
+    void *p = nullptr;
+    if (posix_memalign(&p, max(static_cast<size_t>(alignment), sizeof(void *)), size != 0 ? size : 1) == 0)
+        return p;
+    throw bad_alloc{};
+}
+// the new above allocates with malloc, so free is the matching release. gcc only sees the free of a
+// pointer from a new expression once the delete is inlined and reports a false mismatch
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void *p) noexcept                           { free(p); }
+void operator delete(void *p, size_t) noexcept                   { free(p); }
+void operator delete(void *p, align_val_t) noexcept              { free(p); }
+void operator delete(void *p, size_t, align_val_t) noexcept      { free(p); }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// switch the calling thread to SCHED_FIFO at the given priority and fault in its stack,
+// 0 keeps the default scheduling
+void make_realtime(int priority) {
+    if (priority == 0)
+        return;
+    sched_param param{};
+    param.sched_priority = priority;
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+        cerr << "Cannot set realtime priority " << priority << "! (needs root or CAP_SYS_NICE)\n";
+        exit(-1);
+    }
+    // touch every page of the first part of the stack, so a deep call in the loop does not page fault
+    constexpr size_t prefault_size = 256 * 1024;
+    volatile unsigned char stack[prefault_size];
+    for (size_t i = 0; i < prefault_size; i += 4096)
+        stack[i] = 0;
+    (void)stack[0];
+}
 
-    timeval tv;
-    tv.tv_sec  = remaining_s.count();
-    tv.tv_usec = remianing_us.count();
-    return tv;
+// lock all current and future pages of the process into memory, so the hot loops never page fault. the
+// locked stack of every thread is resident, so the threads created later get a small stack instead of
+// the default 8 MiB, still above the part make_realtime() faults in
+void lock_memory() {
+    constexpr size_t thread_stack_size = 512 * 1024;
+    pthread_attr_t attr;
+    if (pthread_attr_init(&attr) != 0 || pthread_attr_setstacksize(&attr, thread_stack_size) != 0 || pthread_setattr_default_np(&attr) != 0) {
+        cerr << "Cannot set the stack size of the threads!\n";
+        exit(-1);
+    }
+    pthread_attr_destroy(&attr);
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        cerr << "Cannot lock the memory! (needs root or CAP_IPC_LOCK)\n";
+        exit(-1);
+    }
 }
 
+// a led channel driven by a subset of the usb events, a negative bus or device matches all of them
+struct Channel {
+    enum class Direction { Any, In, Out };
+    // usbmon transfer types, the bit of a type in the types mask
+    enum Type : uint8_t { Iso = 0, Interrupt = 1, Control = 2, Bulk = 3 };
+    static constexpr uint8_t all_types = 0b1111;
+
+    int                bus       = -1;
+    int                device    = -1;
+    Direction          direction = Direction::Any;
+    uint8_t            types     = all_types;
+    std::vector<int>   pins;
+    // the global rates and period are used if not given
+    optional<uint64_t> max_transfer_rate;
+    optional<uint64_t> min_transfer_rate;
+    optional<duration_t> pwm_periode;
+    // network interface or block device of the channel, counted by its sysfs counters instead of usbmon.
+    // the direction selects the received/read (in), the transmitted/written (out) or both byte counters
+    std::string        net;
+    std::string        block;
+    // ipv4 address of a publishing host and the index of its mapping, the rates are received by udp
+    std::string        remote;
+    int                remote_channel = 0;
+
+    bool is_counter() const noexcept {
+        return !net.empty() || !block.empty() || !remote.empty();
+    }
+
+    // dump the channel config
+    void print() const noexcept {
+        constexpr char const *directions[] = { "any", "in", "out" };
+        if (!net.empty())
+            printf("net: %s dir: %s max: ", net.c_str(), directions[static_cast<int>(direction)]);
+        else if (!block.empty())
+            printf("block: %s dir: %s max: ", block.c_str(), directions[static_cast<int>(direction)]);
+        else if (!remote.empty())
+            printf("remote: %s channel: %d max: ", remote.c_str(), remote_channel);
+        else
+            printf("bus: %d dev: %d dir: %s types: 0x%x max: ", bus, device, directions[static_cast<int>(direction)], types);
+        max_transfer_rate ? printf("%.3f kbps", *max_transfer_rate / 1024.0) : printf("-");
+        printf(" min: ");
+        min_transfer_rate ? printf("%.3f kbps", *min_transfer_rate / 1024.0) : printf("-");
+        printf(" period: ");
+        pwm_periode ? printf("%.3f s", to_sec(*pwm_periode)) : printf("-");
+        printf(" pins: ");
+        std::copy(pins.begin(), pins.end(), std::ostream_iterator<int>(std::cout, ", "));
+    }
+};
+
 // Configuration change defaults here
 struct Config {
+    static constexpr size_t max_channels = 32;
+
     bool       logging           = false;
     bool       invert            = false;
+#ifdef USB_LED_FIXED
+    uint64_t   max_transfer_rate = USB_LED_FIXED_MAX;
+    uint64_t   min_transfer_rate = USB_LED_FIXED_MIN;
+    duration_t pwm_periode       = chrono::milliseconds(USB_LED_FIXED_PERIOD_MS);
+    double     off_periode_ratio = USB_LED_FIXED_OFF_PERCENT / 100.0;
+#else
     uint64_t   max_transfer_rate = 10 * 1024 * 1024;
     uint64_t   min_transfer_rate = 0;
     duration_t pwm_periode       = 100ms;
     double     off_periode_ratio = 0.1;
+#endif
+    int        capture_cpu       = -1;
+    bool       busypoll          = false;   // the capture thread spins on its cpu instead of waiting for events
+    int        pwm_cpu           = -1;
+    int        rt_priority       = 0;    // SCHED_FIFO priority of the pwm thread, 0 keeps the default scheduling
+    enum class Estimate { Periode, Ewma, Window };
+    Estimate   estimate          = Estimate::Periode;
+    duration_t estimate_time     = 0ms;
+    enum class Scale { Linear, Log };
+    Scale      scale             = Scale::Linear;
+    double     gamma             = 1.0; // exponent of the duty cycle, e.g. 2.2 for a perceptually even brightness
+    uint32_t   dither            = 1;   // pulses per period, the on time is spread over the period
+    duration_t auto_range_time   = 0ms;
+    size_t     duty_table_levels = 0;
+    uint32_t   idle_periods      = 0;   // periods without traffic before the pwm thread sleeps, 0 never sleeps
+    uint32_t   ring_size         = 0;   // size of the usbmon ring in bytes, 0 keeps the kernel default
+    bool       drop_compensation = false;
+    size_t     top_devices       = 5;   // devices of the top talkers view, 0 disables it
+    enum class Output { WiringPi, HardwarePwm, GpioMem, Gpiod, Null };
+#if defined(USING_WIRING_PI)
+    Output     output            = Output::WiringPi;
+#elif defined(USING_LIBGPIOD)
+    Output     output            = Output::Gpiod;
+#else
+    Output     output            = Output::Null;
+#endif
+    int        pwm_chip          = 0;
+    std::string gpio_chip        = "gpiochip0";
+    bool       bench             = false;
+    uint64_t   bench_rate        = 100000;
+    duration_t bench_time        = 10s;
+    std::string             bench_file;
+    std::string             record_file;
+    std::string             stats_socket;
+    std::string             control_socket;
+    std::string             publish_target;     // "address:port" the rates are sent to every period
+    uint16_t                subscribe_port    = 0;
     std::vector<int>        led_pins;
+    std::vector<int>        usb_buses;
+    std::vector<Channel>    channels;
 
     // dump the current config
     void print() const noexcept {
+        constexpr char const *output_names[]   = { "wiringpi", "hwpwm", "gpiomem", "gpiod", "null" };
+        constexpr char const *estimate_names[] = { "periode", "ewma half-life", "window" };
+        constexpr char const *scale_names[]    = { "linear", "log" };
         printf(
             "\nConfiguration:\n\t"
             "logging: %d \n\t"
@@ -73,29 +370,139 @@ struct Config {
             "off_period_ratio: %.0f %%\n\t"
             "max_transfer_rate: %.3f kbps\n\t"
             "min_transfer_rate: %.3f kbps\n\t"
-            "inverted: %d \n\t",
+            "inverted: %d \n\t"
+            "capture_cpu: %d (busy poll %d) \n\t"
+            "pwm_cpu: %d \n\t"
+            "rt priority: %d \n\t"
+            "estimate: %s %.3f s\n\t"
+            "scale: %s (gamma %.2f, auto range half-life %.3f s)\n\t"
+            "dither: %u pulses/period\n\t"
+            "duty table: %zu levels\n\t"
+            "idle after: %u periods\n\t"
+            "usbmon ring: %u bytes (drop compensation %d) \n\t"
+            "top devices: %zu \n\t"
+            "output: %s (pwmchip%d, %s) \n\t"
+            "bench: %d (%llu events/s, %.3f s, %s) \n\t"
+            "record: %s \n\t"
+            "stats: %s \n\t"
+            "control: %s \n\t"
+            "publish: %s subscribe: %u \n\t",
             logging,
             to_sec(pwm_periode),
             off_periode_ratio * 100,
             max_transfer_rate / 1024.0,
             min_transfer_rate / 1024.0,
-            invert
+            invert,
+            capture_cpu,
+            busypoll,
+            pwm_cpu,
+            rt_priority,
+            estimate_names[static_cast<int>(estimate)],
+            to_sec(estimate_time),
+            scale_names[static_cast<int>(scale)],
+            gamma,
+            to_sec(auto_range_time),
+            dither,
+            duty_table_levels,
+            idle_periods,
+            ring_size,
+            drop_compensation,
+            top_devices,
+            output_names[static_cast<int>(output)],
+            pwm_chip,
+            gpio_chip.c_str(),
+            bench,
+            static_cast<unsigned long long>(bench_rate),
+            to_sec(bench_time),
+            bench_file.empty() ? "generated" : bench_file.c_str(),
+            record_file.empty() ? "-" : record_file.c_str(),
+            stats_socket.empty() ? "SIGUSR1" : stats_socket.c_str(),
+            control_socket.empty() ? "-" : control_socket.c_str(),
+            publish_target.empty() ? "-" : publish_target.c_str(),
+            subscribe_port
         );
         printf("pins: ");
         std::copy(led_pins.begin(), led_pins.end(), std::ostream_iterator<int>(std::cout, ", "));
+        printf("\n\tbuses: ");
+        std::copy(usb_buses.begin(), usb_buses.end(), std::ostream_iterator<int>(std::cout, ", "));
+        for (auto const &ch : channels) {
+            printf("\n\tmap: ");
+            ch.print();
+        }
         puts("\n\n");
     }
 
-    // convert the transfer rates to the given periode
+    // without a mapping all pins show all events, channels without rates use the global ones
+    void resolve_channels() noexcept {
+        if (channels.empty()) {
+            channels.emplace_back();
+            channels.back().pins = led_pins;
+        }
+        for (auto &ch : channels) {
+            ch.max_transfer_rate = ch.max_transfer_rate.value_or(max_transfer_rate);
+            ch.min_transfer_rate = ch.min_transfer_rate.value_or(min_transfer_rate);
+            ch.pwm_periode       = ch.pwm_periode.value_or(pwm_periode);
+        }
+    }
+
+    // bitmask of the pins of a channel, the pins are range checked by the parser
+    static uint32_t pin_mask(Channel const &ch) noexcept {
+        uint32_t mask = 0;
+        for (auto p : ch.pins)
+            mask |= 1u << p;
+        return mask;
+    }
+
+    // all pins of all channels
+    std::vector<int> used_pins() const {
+        std::vector<int> pins;
+        for (auto const &ch : channels)
+            pins.insert(pins.end(), ch.pins.begin(), ch.pins.end());
+        sort(pins.begin(), pins.end());
+        pins.erase(unique(pins.begin(), pins.end()), pins.end());
+        return pins;
+    }
+
+    // convert the transfer rates to the given periode, the rates of a channel to its own period
     void calculate_periode_values() noexcept {
         max_transfer_rate *= to_sec(pwm_periode);
         min_transfer_rate *= to_sec(pwm_periode);
+        for (auto &ch : channels) {
+            *ch.max_transfer_rate *= to_sec(*ch.pwm_periode);
+            *ch.min_transfer_rate *= to_sec(*ch.pwm_periode);
+        }
+    }
+
+    // true if any channel counts the usb traffic, a config without mappings counts all usb traffic
+    bool has_usb_channels() const noexcept {
+        return channels.empty() || any_of(channels.begin(), channels.end(), [](auto const &ch) { return !ch.is_counter(); });
+    }
+    // true if any channel reads a network, block device or remote counter
+    bool has_counter_channels() const noexcept {
+        return any_of(channels.begin(), channels.end(), [](auto const &ch) { return ch.is_counter(); });
+    }
+
+    // true if a channel runs with another period than the global one
+    bool has_channel_periodes() const noexcept {
+        return any_of(channels.begin(), channels.end(), [this](auto const &ch) { return ch.pwm_periode != pwm_periode; });
+    }
+
+    // calculate the high and low duration of the led of a channel based on the settings
+    pair<duration_t, duration_t> calculate_durations(Channel const &ch, uint64_t bytes) const noexcept {
+        return calculate_durations(bytes, *ch.min_transfer_rate, *ch.max_transfer_rate, *ch.pwm_periode);
     }
 
-    // calculate the high and low duration of the led based on the settings
-    pair<duration_t, duration_t> calculate_durations(uint64_t bytes) const noexcept {
+    // calculate the high and low duration of the led for the given range and period, the log scale spreads
+    // rates of several magnitudes evenly over the duty cycle. the gamma makes the brightness steps look even,
+    // the duty table applies it once per level at the start
+    pair<duration_t, duration_t> calculate_durations(uint64_t bytes, uint64_t min_transfer_rate, uint64_t max_transfer_rate, 
+                                                     duration_t pwm_periode) const noexcept {
         auto clamped   = clamp(bytes, min_transfer_rate, max_transfer_rate);
-        auto ratio     = static_cast<double>(clamped - min_transfer_rate) / (max_transfer_rate - min_transfer_rate);
+        auto ratio     = scale == Scale::Log
+            ? log1p(static_cast<double>(clamped - min_transfer_rate)) / log1p(static_cast<double>(max_transfer_rate - min_transfer_rate))
+            : static_cast<double>(clamped - min_transfer_rate) / (max_transfer_rate - min_transfer_rate);
+        if (gamma != 1.0)
+            ratio = pow(ratio, gamma);
         auto on_ration = ratio * (1.0 - off_periode_ratio);
         return { 
             multiply_duration(pwm_periode, on_ration),
@@ -104,192 +511,3165 @@ struct Config {
     }
 };
 
-class UsbMon {
-    int      fd                = -1;
-    uint64_t accumulated_bytes = 0;
-    fd_set   waiting;
+// smooths the bytes per period of a channel, the estimate keeps the unit of bytes per period.
+// the default uses every period on its own, ewma decays by the given half-life and the window
+// averages the buckets of the last periods covering the window
+class Estimator {
+    Config::Estimate      mode;
+    double                alpha   = 1.0;
+    double                average = 0.0;
+    bool                  primed  = false;
+    std::vector<uint64_t> buckets;
+    size_t                next    = 0;
+    size_t                filled  = 0;
+    uint64_t              sum     = 0;
 public:
-    UsbMon() {
-        fd = open("/dev/usbmon0", O_RDONLY);
-        if (fd == -1) {
-            cerr << "Cannot open usbmon device! forget sudo or modprobe? (\"sudo modprobe usbmon\") \n";
-            exit(-1);
+    Estimator(Config const &cfg, Channel const &ch) : mode{ cfg.estimate } {
+        auto periodes = max(1.0, to_sec(cfg.estimate_time) / to_sec(*ch.pwm_periode));
+        if (mode == Config::Estimate::Ewma)
+            alpha = 1.0 - exp2(-1.0 / periodes);
+        if (mode == Config::Estimate::Window)
+            buckets.resize(static_cast<size_t>(periodes));
+    }
+
+    // add the bytes of the last period and return the estimate, O(1) in every mode
+    uint64_t update(uint64_t bytes) noexcept {
+        switch (mode) {
+            case Config::Estimate::Ewma:
+                average = primed ? average + alpha * (static_cast<double>(bytes) - average) : bytes;
+                primed  = true;
+                return static_cast<uint64_t>(average);
+            case Config::Estimate::Window:
+                sum += bytes - exchange(buckets[next], bytes);
+                next   = (next + 1) % buckets.size();
+                filled = min(filled + 1, buckets.size());
+                return sum / filled;
+            default:
+                return bytes;
         }
-        FD_ZERO(&waiting);
     }
-    ~UsbMon() {
-        close(fd);
+};
+
+// rolling range of the estimates of a channel for the auto range mode. new extremes move the bounds at
+// once, otherwise the bounds relax toward each other by the half-life. O(1) per period, no history kept
+class AutoRange {
+    double decay  = 0.0;
+    double low    = 0.0;
+    double high   = 0.0;
+    bool   primed = false;
+public:
+    AutoRange(Config const &cfg, Channel const &ch) {
+        if (cfg.auto_range_time > 0ms)
+            decay = 1.0 - exp2(-to_sec(*ch.pwm_periode) / to_sec(cfg.auto_range_time));
     }
-    // sum all the bytes over a given duration
-    duration_t accumulate_bytes_for(duration_t const &dur) noexcept {
-        auto tsc   = now();
-        auto until = tsc + dur; 
-        while ( now() < until ) {
-            accumulated_bytes += get_transfered_bytes(until);
+
+    // the range to map the estimate into, the configured minimum stays the off threshold
+    pair<uint64_t, uint64_t> update(Channel const &ch, uint64_t estimate) noexcept {
+        if (decay == 0.0)
+            return { *ch.min_transfer_rate, *ch.max_transfer_rate };
+        auto value = static_cast<double>(estimate);
+        if (!primed) {
+            low = high = value;
+            primed = true;
         }
-        return chrono::duration_cast<duration_t>(now() - tsc);
+        auto shrink = (high - low) * decay;
+        high = max(value, high - shrink);
+        low  = min(value, low + shrink);
+        auto lower = max(static_cast<uint64_t>(low), *ch.min_transfer_rate);
+        return { lower, max(static_cast<uint64_t>(high), lower + 1) };
     }
-    // exchange the accumulated value with zero
-    uint64_t get_and_reset_accumulated_bytes() noexcept {
-        return exchange(accumulated_bytes, 0);
+};
+
+// rate to duty table of a channel built once at startup, the per period mapping is an index
+// calculation and a single load. level i holds the durations of min + i * (max - min) / levels
+class DutyTable {
+    uint64_t                minimum;
+    uint64_t                range;
+    uint64_t                multiplier;
+    duration_t              periode;
+    std::vector<duration_t> highs;
+public:
+    DutyTable(Config const &cfg, Channel const &ch, size_t levels)
+        : minimum{ *ch.min_transfer_rate }, range{ max<uint64_t>(*ch.max_transfer_rate - minimum, 1) }, periode{ *ch.pwm_periode } {
+        // 32 bit fixed point reciprocal of the level width, rounded up so the maximum reaches the last level
+        multiplier = ((static_cast<uint64_t>(levels) << 32) + range - 1) / range;
+        highs.resize(levels + 1);
+        for (size_t i = 0; i <= levels; ++i)
+            highs[i] = cfg.calculate_durations(minimum + range * i / levels, minimum, minimum + range, periode).first;
     }
-private:
-    // get the transfered byte from the last packet
-    uint64_t get_transfered_bytes(timepoint_t const &until) noexcept {
-        constexpr auto type_offset   = 8;
-        constexpr auto length_offset = 32;
-        unsigned char buffer[64];
-
-        timeval tv = get_timeval_until(until);
-        FD_SET(fd, &waiting);
-        int ret = select(fd+1, &waiting, nullptr, nullptr, &tv);
-        if (ret == -1 || ret == 0) 
-            return 0;
-        // lagacy read only returns 48 bytes
-        if (read(fd, &buffer, 64) != 48) 
-            return 0; 
-        // only accumulate the CALLBACK type
-        if (buffer[type_offset] != 'S' && buffer[type_offset] != 'C') 
-            return 0; 
-        return *reinterpret_cast<unsigned int*>(&buffer[length_offset]);
+
+    pair<duration_t, duration_t> lookup(uint64_t bytes) const noexcept {
+        auto offset = clamp(bytes, minimum, minimum + range) - minimum;
+        auto high   = highs[min<uint64_t>((offset * multiplier) >> 32, highs.size() - 1)];
+        return { high, periode - high };
     }
 };
 
-class Raspi {
-    std::vector<int> const &pins;
-    bool inverted;
+#ifdef USB_LED_FIXED
+// duty table of the fixed build (make fixed), the rates, the period and the off ratio are compile time
+// constants so the table is computed by the compiler. only the linear scale is supported
+template<uint64_t MinRate, uint64_t MaxRate, int64_t PeriodeMs, unsigned OffPercent, size_t Levels>
+struct FixedDutyTable {
+    static constexpr double   periode_s = PeriodeMs / 1000.0;
+    static constexpr uint64_t minimum   = static_cast<uint64_t>(MinRate * periode_s);
+    static constexpr uint64_t range     = max<uint64_t>(static_cast<uint64_t>(MaxRate * periode_s) - minimum, 1);
+    static constexpr uint64_t multiplier = ((static_cast<uint64_t>(Levels) << 32) + range - 1) / range;
+    static_assert(MaxRate > MinRate, "the maximum rate must be above the minimum rate");
+
+    static constexpr duration_t periode = chrono::milliseconds(PeriodeMs);
+
+    static constexpr array<duration_t::rep, Levels + 1> build() noexcept {
+        array<duration_t::rep, Levels + 1> highs{};
+        for (size_t i = 0; i <= Levels; ++i) {
+            auto ratio = static_cast<double>(range * i / Levels) / range;
+            highs[i]   = static_cast<duration_t::rep>(periode.count() * (ratio * (1.0 - OffPercent / 100.0)));
+        }
+        return highs;
+    }
+    static constexpr auto highs = build();
+
+    static pair<duration_t, duration_t> lookup(uint64_t bytes) noexcept {
+        auto offset = clamp(bytes, minimum, minimum + range) - minimum;
+        auto high   = duration_t(highs[min<uint64_t>((offset * multiplier) >> 32, Levels)]);
+        return { high, periode - high };
+    }
+};
+
+#ifndef USB_LED_FIXED_LEVELS
+#define USB_LED_FIXED_LEVELS 256
+#endif
+using fixed_duty_table_t = FixedDutyTable<USB_LED_FIXED_MIN, USB_LED_FIXED_MAX, USB_LED_FIXED_PERIOD_MS, 
+                                          USB_LED_FIXED_OFF_PERCENT, USB_LED_FIXED_LEVELS>;
+#endif
+
+// log-linear histogram (HDR style) with 16 sub-buckets per power of two, the relative error is below 6.25%.
+// only one thread records, so a relaxed load and store replace the atomic increment
+class Histogram {
+    static constexpr unsigned sub_bits = 4;
+    static constexpr uint64_t sub_size = 1u << sub_bits;
+    static constexpr size_t   buckets  = (64 - sub_bits + 1) * sub_size;
+
+    array<atomic<uint64_t>, buckets> counts{};
 public:
-    Raspi(std::vector<int> const &p, bool inv) : pins{ p }, inverted{ inv } {
-        #ifdef USING_WIRING_PI
-            wiringPiSetupGpio();
-            for (auto &p : pins)
-                pinMode(p, OUTPUT);
-        #endif
+    static constexpr size_t index(uint64_t value) noexcept {
+        if (value < sub_size)
+            return value;
+        unsigned msb = 63 - __builtin_clzll(value);
+        return ((msb - sub_bits + 1) << sub_bits) | ((value >> (msb - sub_bits)) & (sub_size - 1));
     }
-    enum class LedState { On, Off};
-    void set_led_state(Raspi::LedState state) const noexcept {
-        #ifdef USING_WIRING_PI
-            if ((state == LedState::On) != inverted) {
-                for (auto &p : pins)
-                    digitalWrite(p, HIGH);
-            } else {
-                for (auto &p : pins)
-                    digitalWrite(p, LOW);
-            }
-        #endif
+    static constexpr uint64_t lower_bound(size_t i) noexcept {
+        if (i < sub_size)
+            return i;
+        unsigned msb = (i >> sub_bits) + sub_bits - 1;
+        return (sub_size | (i & (sub_size - 1))) << (msb - sub_bits);
+    }
+
+    void record(uint64_t value) noexcept {
+        auto &count = counts[index(value)];
+        count.store(count.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+    uint64_t count() const noexcept {
+        uint64_t total = 0;
+        for (auto const &c : counts)
+            total += c.load(memory_order_relaxed);
+        return total;
+    }
+    // lower bound of the bucket holding the given quantile, 1.0 is the maximum
+    uint64_t quantile(double q) const noexcept {
+        auto total = count();
+        if (total == 0)
+            return 0;
+        auto     rank = static_cast<uint64_t>(q * (total - 1));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < buckets; ++i) {
+            seen += counts[i].load(memory_order_relaxed);
+            if (seen > rank)
+                return lower_bound(i);
+        }
+        return lower_bound(buckets - 1);
+    }
+    // one line summary, the values are divided by the scale
+    std::string summary(char const *name, char const *unit, double scale) const {
+        char line[160];
+        snprintf(line, sizeof(line), "%-18s count %10llu   p50 %9.1f %s   p99 %9.1f %s   p99.9 %9.1f %s   max %9.1f %s\n",
+            name, static_cast<unsigned long long>(count()),
+            quantile(0.5) / scale, unit, quantile(0.99) / scale, unit, quantile(0.999) / scale, unit, quantile(1.0) / scale, unit);
+        return line;
     }
 };
 
-// automatically generate pwm time based on the sample interval and the maximum transfer rate 
-static void generate_led_pwm(Config const &cfg, Raspi const &raspi, UsbMon &monitor) {
-    timepoint_t tsc = now(), last_tsc = tsc;
+// hot path statistics, every histogram has a single writer thread
+struct Stats {
+    Histogram syscall_ns;        // capture thread: duration of every fetch or read syscall that got events or blocked
+    Histogram event_latency_ns;  // capture thread: age of the oldest event of every fetch, from its usbmon timestamp
+    Histogram events_per_wakeup; // capture thread: events drained per wakeup
+    Histogram lateness_ns;       // pwm thread: wakeup of an edge after its deadline
+    atomic<uint64_t> dropped_log_records{ 0 }; // pwm thread: records the logger had no room for
+    // capture thread: total bytes by direction (0 out, 1 in) * 4 + transfer type
+    array<atomic<uint64_t>, 8> traffic_bytes{};
+    // capture thread: total bytes of every device by bus * 128 + device number, the last bus slot collects
+    // the buses above 31
+    static constexpr size_t device_buses   = 33;
+    static constexpr size_t device_numbers = 128;
+    array<atomic<uint64_t>, device_buses * device_numbers> device_bytes{};
+    size_t           top_devices = 5;   // devices of the top talkers view, 0 disables it, set before any thread starts
+    // pwm thread: idle phases without traffic and the period wakeups they skipped
+    atomic<uint64_t> idle_entries{ 0 };
+    atomic<int64_t>  idle_ns{ 0 };
+    atomic<uint64_t> idle_saved_wakeups{ 0 };
+    // heap allocations in the loops of the pwm and the capture thread after their setup, should stay 0
+    atomic<uint64_t> pwm_allocations{ 0 };
+    atomic<uint64_t> capture_allocations{ 0 };
+    // capture thread: events usbmon dropped because the ring was full, most events queued at a query
+    atomic<uint64_t> usbmon_dropped{ 0 };
+    atomic<uint64_t> usbmon_queued_max{ 0 };
+    // capture thread: records handed to the trace writer and records dropped because it fell behind
+    atomic<uint64_t> trace_records{ 0 };
+    atomic<uint64_t> trace_dropped{ 0 };
+    // pwm thread: writes and switched pins of the null output
+    atomic<uint64_t> null_writes{ 0 };
+    atomic<uint64_t> null_switches{ 0 };
+    timepoint_t      started = now();
 
-    for(;;) {
-        auto bytes_acc = monitor.get_and_reset_accumulated_bytes();
+    struct Talker {
+        uint64_t bytes;
+        uint32_t slot;   // index into device_bytes
+    };
+    // the n devices with the most bytes since the start, or since the snapshot of device_bytes which is updated.
+    // a single scan collects the devices with traffic, only the n largest of them are ordered
+    vector<Talker> top_talkers(size_t n, uint64_t *since = nullptr) const {
+        vector<Talker> talkers;
+        for (uint32_t slot = 0; slot < device_bytes.size(); ++slot) {
+            auto total = device_bytes[slot].load(memory_order_relaxed);
+            auto bytes = since ? total - exchange(since[slot], total) : total;
+            if (bytes != 0)
+                talkers.push_back({ bytes, slot });
+        }
+        auto top = talkers.begin() + min(n, talkers.size());
+        partial_sort(talkers.begin(), top, talkers.end(), [](auto const &a, auto const &b) { return a.bytes > b.bytes; });
+        talkers.erase(top, talkers.end());
+        return talkers;
+    }
 
-        auto [high, low] = cfg.calculate_durations(bytes_acc);
+    std::string top_report() const {
+        uint64_t total = 0;
+        for (auto const &bytes : device_bytes)
+            total += bytes.load(memory_order_relaxed);
+        std::string report;
+        for (auto const &talker : top_talkers(top_devices)) {
+            char line[160];
+            snprintf(line, sizeof(line), "top device:        bus %2u dev %3u   %.3f MB (%.1f%%)\n", talker.slot / static_cast<uint32_t>(device_numbers),
+                talker.slot % static_cast<uint32_t>(device_numbers), talker.bytes / 1048576.0, total ? 100.0 * talker.bytes / total : 0.0);
+            report += line;
+        }
+        return report;
+    }
 
-        raspi.set_led_state(Raspi::LedState::On);
-        duration_t high_measured = monitor.accumulate_bytes_for(high);
+    std::string idle_report() const {
+        auto up = to_sec(now() - started);
+        auto saved = idle_saved_wakeups.load(memory_order_relaxed);
+        char line[160];
+        snprintf(line, sizeof(line), "idle:              entries %llu   time %.3f s   saved wakeups %llu (%.1f/s)\n",
+            static_cast<unsigned long long>(idle_entries.load(memory_order_relaxed)), idle_ns.load(memory_order_relaxed) / 1e9,
+            static_cast<unsigned long long>(saved), up > 0 ? saved / up : 0.0);
+        return line;
+    }
 
-        raspi.set_led_state(Raspi::LedState::Off);
-        duration_t low_measured = monitor.accumulate_bytes_for(low);
- 
-        if (cfg.logging) {
-            printf(
-                "Rate: %9.3f kb/s   PWM: %6.3f s   [H: %6.3f s   L:%6.3f s]\n", 
-                bytes_acc / to_sec(cfg.pwm_periode) / 1024.0, 
-                to_sec(tsc - last_tsc), 
-                to_sec(high_measured),
-                to_sec(low_measured)
-            );
+    std::string traffic_report() const {
+        constexpr char const *types[] = { "iso", "int", "ctrl", "bulk" };
+        std::string report;
+        for (int dir = 1; dir >= 0; --dir) {
+            char line[160];
+            auto const *t = &traffic_bytes[dir * 4];
+            snprintf(line, sizeof(line), "traffic %-4s       %s %.3f MB   %s %.3f MB   %s %.3f MB   %s %.3f MB\n", dir ? "in:" : "out:",
+                types[0], t[0] / 1048576.0, types[1], t[1] / 1048576.0, types[2], t[2] / 1048576.0, types[3], t[3] / 1048576.0);
+            report += line;
         }
-        last_tsc = std::exchange(tsc, now());
+        return report;
     }
-}
 
-void print_help() {
-    puts(
-        "-help                 ... print this message\n" \
-        "-logging              ... enable logging\n" \
-        "-period value[s,ms]   ... pwm period\n" \
-        "-off value[%]         ... enforced off period of the led in percent\n" \
-        "-max value[Mbps,kbps] ... maximum usb transfer rate\n" \
-        "-min value[Mbps,kbps] ... minimum usb transfer rate\n" \
-        "-pin value            ... pin to use\n" \
-        "-inv                  ... invert the HIGH and LOW state\n"
-    );
-}
+    std::string report() const {
+        return "\nStatistics:\n"
+            + syscall_ns.summary("syscall:", "us", 1e3)
+            + event_latency_ns.summary("event latency:", "us", 1e3)
+            + events_per_wakeup.summary("events/wakeup:", "  ", 1.0)
+            + lateness_ns.summary("edge lateness:", "us", 1e3)
+            + "log drops:         " + to_string(dropped_log_records.load(memory_order_relaxed)) + "\n"
+            + "usbmon drops:      " + to_string(usbmon_dropped.load(memory_order_relaxed))
+            + "   queued max " + to_string(usbmon_queued_max.load(memory_order_relaxed)) + "\n"
+            + "loop allocations:  pwm " + to_string(pwm_allocations.load(memory_order_relaxed)) 
+            + "   capture " + to_string(capture_allocations.load(memory_order_relaxed)) + "\n"
+            + "trace records:     " + to_string(trace_records.load(memory_order_relaxed))
+            + "   dropped " + to_string(trace_dropped.load(memory_order_relaxed)) + "\n"
+            + idle_report()
+            + traffic_report()
+            + top_report();
+    }
+};
 
-[[noreturn]] void unknown_argument_kill(string_view const &v) {
-    cout << "Unknown or invalid argument: " << v << endl;
-    print_help();
-    exit(-1);
-}
+// adds the heap allocations of the calling thread since the last check to a counter
+class AllocationCheck {
+    atomic<uint64_t> &total;
+    uint64_t          baseline = thread_allocations;
+public:
+    AllocationCheck(atomic<uint64_t> &t) : total{ t } {}
 
-template<typename T, typename V = uint64_t>
-T parse_value(string_view const &v, map<string_view, V> const &extentions) {
-    int value = 0;
-    auto [p, ec] = from_chars(v.data(), v.data() + v.size(), value);
-    if (ec != errc{}) {
-        unknown_argument_kill(v);
+    // the allocations before are part of the setup
+    void reset() noexcept {
+        baseline = thread_allocations;
     }
-    if (extentions.empty()) {
-        return T(value);
+    void verify() noexcept {
+        if (thread_allocations == baseline)
+            return;
+        total.store(total.load(memory_order_relaxed) + thread_allocations - baseline, memory_order_relaxed);
+        baseline = thread_allocations;
     }
-    string_view extention{ p };
-    auto multiplier = extentions.find(extention);
-    if (multiplier == extentions.end()) {
-        unknown_argument_kill(extention);
+};
+
+// usbmon events of the benchmark mode, either generated in memory or a file of binary 64 byte usbmon headers
+class Replay {
+    static constexpr size_t header_size     = sizeof(mon_bin_hdr);
+    static constexpr size_t generated_count = 4096;
+
+    std::vector<mon_bin_hdr> generated;
+    mon_bin_hdr const       *records   = nullptr;
+    trace_record const      *traces    = nullptr;   // set instead of the records for a trace file of -record
+    void const              *mapped    = nullptr;
+    size_t                   count     = 0;
+    size_t                   file_size = 0;
+public:
+    Replay(std::string const &file) {
+        file.empty() ? generate() : map_file(file);
     }
-    return T(value * multiplier->second);
-}
+    ~Replay() {
+        if (file_size != 0)
+            munmap(const_cast<void *>(mapped), file_size);
+    }
+    Replay(Replay const &) = delete;
+    Replay &operator=(Replay const &) = delete;
 
-auto const size_extentions    = map<string_view, uint64_t> {{ "Mbps"sv, 1024*1024 }, { "kbps"sv, 1024 }};
-auto const time_extentions    = map<string_view, uint64_t> {{ "s"sv, 1000 }, { "ms"sv, 1 }};
-auto const percent_extentions = map<string_view, double>   {{ "%"sv, 1.0/100.0 }};
+    // the records are replayed in an endless loop
+    mon_bin_hdr const *record(size_t index) const noexcept {
+        return records + index % count;
+    }
+    // the same for a trace file, nullptr if the replay has usbmon headers
+    trace_record const *trace(size_t index) const noexcept {
+        return traces != nullptr ? traces + index % count : nullptr;
+    }
+    // the number of records that follow the given one in memory before the loop wraps
+    size_t contiguous(size_t index) const noexcept {
+        return count - index % count;
+    }
+private:
+    // bulk and interrupt submissions and callbacks of a few devices on three buses
+    void generate() {
+        generated.resize(generated_count);
+        uint32_t seed = 0x2545f491;
+        auto random = [&seed] { return seed = seed * 1664525 + 1013904223; };
+        for (size_t i = 0; i < generated_count; ++i) {
+            auto &header     = generated[i];
+            header.busnum    = static_cast<uint16_t>(1 + random() % 3);
+            header.len_urb   = 512 + random() % 65536;
+            header.type      = (i & 1) ? 'C' : 'S';
+            header.xfer_type = (random() >> 16 & 7) == 0 ? 1 : 3;
+            header.epnum     = static_cast<unsigned char>((random() & 0x80) | 1);
+            header.devnum    = static_cast<unsigned char>(1 + random() % 8);
+        }
+        records = generated.data();
+        count   = generated_count;
+    }
 
-auto const zero_argument_commands = map<string_view, void(*)(Config &)> {
-    { "-logging"sv, [](auto &cfg) { cfg.logging = true; }},
-    { "-help"sv,    [](auto &cfg) { print_help();       }},
-    { "-inv"sv,     [](auto &cfg) { cfg.invert = true;  }},
+    void map_file(std::string const &file) {
+        int fd = open(file.c_str(), O_RDONLY);
+        struct stat info{};
+        // the shortest file is a trace header, a file of usbmon headers is checked once it is known
+        if (fd == -1 || fstat(fd, &info) == -1 || static_cast<size_t>(info.st_size) < sizeof(trace_header)) {
+            cerr << "Cannot open replay file " << file << "!\n";
+            exit(-1);
+        }
+        mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            cerr << "Cannot map replay file " << file << "!\n";
+            exit(-1);
+        }
+        file_size = info.st_size;
+        // a trace of -record or a plain file of usbmon headers
+        auto const *header = static_cast<trace_header const *>(mapped);
+        if (memcmp(header->magic, trace_magic, sizeof(trace_magic)) == 0) {
+            count  = (file_size - sizeof(trace_header)) / sizeof(trace_record);
+            traces = reinterpret_cast<trace_record const *>(header + 1);
+            if (header->record_size != sizeof(trace_record) || count == 0) {
+                cerr << "Invalid trace file " << file << "!\n";
+                exit(-1);
+            }
+            return;
+        }
+        records = static_cast<mon_bin_hdr const *>(mapped);
+        count   = file_size / header_size;
+        if (count == 0) {
+            cerr << "Cannot open replay file " << file << "!\n";
+            exit(-1);
+        }
+    }
 };
 
-auto const one_argument_commands = map<string_view, void(*)(Config &, string_view)> {
-    { "-period"sv, [](auto &cfg, auto value) { cfg.pwm_periode       = parse_value<duration_t>(value, time_extentions);    }},
-    { "-max"sv,    [](auto &cfg, auto value) { cfg.max_transfer_rate = parse_value<uint64_t>  (value, size_extentions);    }},
-    { "-min"sv,    [](auto &cfg, auto value) { cfg.min_transfer_rate = parse_value<uint64_t>  (value, size_extentions);    }},
-    { "-pin"sv,    [](auto &cfg, auto value) { cfg.led_pins.push_back(parse_value<int>       (value, {}));                 }},
-    { "-off"sv,    [](auto &cfg, auto value) { cfg.off_periode_ratio = parse_value<double>    (value, percent_extentions); }},
+// writes the trace of -record with large write()s on its own thread. the capture thread fills one buffer while
+// the writer writes the other, if the writer falls behind the records are dropped and counted, the capture
+// thread never waits for the disk
+class TraceWriter {
+    static constexpr size_t buffer_records = 65536;    // 1 MiB per buffer
+    static constexpr auto   flush_interval = 1s;       // a partial buffer is written after this time
+
+    std::vector<trace_record> buffers[2];
+    size_t           sizes[2] = {};
+    int              active   = 0;                     // capture thread: the buffer being filled
+    timepoint_t      last_flush = now();
+    atomic<int>      pending{ -1 };                    // the buffer handed to the writer, -1 if it is idle
+    atomic<bool>     stopping{ false };
+    int              fd       = -1;
+    int              event_fd = -1;
+    Stats           &stats;
+    std::thread      writer;
+public:
+    TraceWriter(std::string const &file, Stats &s) : stats{ s } {
+        buffers[0].resize(buffer_records);
+        buffers[1].resize(buffer_records);
+        fd       = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        event_fd = eventfd(0, 0);
+        trace_header header{};
+        memcpy(header.magic, trace_magic, sizeof(trace_magic));
+        header.record_size = sizeof(trace_record);
+        if (fd == -1 || event_fd == -1 || write(fd, &header, sizeof(header)) != sizeof(header)) {
+            cerr << "Cannot create trace file " << file << "!\n";
+            exit(-1);
+        }
+        writer = std::thread{ [this] { run(); } };
+    }
+    // the capture thread has to be stopped before, the last partial buffer is written here
+    ~TraceWriter() {
+        stopping = true;
+        uint64_t one = 1;
+        (void)!write(event_fd, &one, sizeof(one));
+        writer.join();
+        write_buffer(active);
+        close(event_fd);
+        close(fd);
+    }
+    TraceWriter(TraceWriter const &) = delete;
+    TraceWriter &operator=(TraceWriter const &) = delete;
+
+    // capture thread: add the parsed fields of an event with its counted bytes
+    void push(mon_bin_hdr const &header, uint32_t bytes) noexcept {
+        if (sizes[active] == buffer_records && !hand_over()) {
+            stats.trace_dropped.store(stats.trace_dropped.load(memory_order_relaxed) + 1, memory_order_relaxed);
+            return;
+        }
+        buffers[active][sizes[active]++] = { static_cast<int64_t>(header.ts_sec) * 1000000 + header.ts_usec, bytes,
+            static_cast<unsigned char>(header.busnum), header.devnum, header.epnum, header.xfer_type };
+        stats.trace_records.store(stats.trace_records.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+    // capture thread: hand a partial buffer to the writer once the flush interval passed
+    void flush_due(timepoint_t tsc) noexcept {
+        if (sizes[active] != 0 && tsc - last_flush >= flush_interval)
+            hand_over();
+    }
+private:
+    // give the active buffer to the writer and continue with the other one, false if the writer is still
+    // busy with the other one
+    bool hand_over() noexcept {
+        if (pending.load(memory_order_acquire) != -1)
+            return false;
+        pending.store(active, memory_order_release);
+        uint64_t one = 1;
+        (void)!write(event_fd, &one, sizeof(one));
+        active     = 1 - active;
+        last_flush = now();
+        return true;
+    }
+
+    void write_buffer(int index) noexcept {
+        auto const *data = reinterpret_cast<char const *>(buffers[index].data());
+        auto  size    = sizes[index] * sizeof(trace_record);
+        for (size_t done = 0; done < size;) {
+            auto written = write(fd, data + done, size - done);
+            if (written <= 0)
+                break;
+            done += written;
+        }
+        sizes[index] = 0;
+    }
+
+    void run() noexcept {
+        for (;;) {
+            uint64_t signaled;
+            (void)!read(event_fd, &signaled, sizeof(signaled));
+            if (auto index = pending.load(memory_order_acquire); index != -1) {
+                write_buffer(index);
+                pending.store(-1, memory_order_release);
+            }
+            if (stopping.load(memory_order_relaxed))
+                return;
+        }
+    }
 };
 
-Config parse_arguments(arguments_t const &arguments) {
-    Config cfg{};
-    auto cur = arguments.cbegin();
-    auto const end = arguments.cend();
+#ifdef USB_LED_MICROBENCH
+int run_microbench(arguments_t const &arguments);
+#endif
 
-    while (cur != end) {
-        auto const argument = *cur++;
-        if (auto cmd = zero_argument_commands.find(argument); cmd != zero_argument_commands.end())
-            cmd->second(cfg);
-        else if (auto cmd = one_argument_commands.find(argument); cmd != one_argument_commands.end() && cur != end)
-            cmd->second(cfg, *cur++);
-        else
-            unknown_argument_kill(argument);
+// captures the usbmon devices on its own thread and publishes the byte counts lock free
+class UsbMon {
+    static constexpr uint32_t batch_size  = 256;
+    static constexpr int      max_wait    = 16;
+    static constexpr uint32_t stop_tag    = UINT32_MAX;
+    // events are routed by a flat bus x device table, higher bus numbers share the last row
+    static constexpr size_t   max_buses   = 32;
+    static constexpr size_t   max_devices = 128;
+    static_assert(Stats::device_buses == max_buses + 1 && Stats::device_numbers == max_devices, "device counters match the routing table");
+    // the drop counters are queried by the capture thread at most this often, only while it is woken by events
+    static constexpr auto     stats_interval = 100ms;
+public:
+    // fixed point 1.0 of the drop scale
+    static constexpr uint32_t drop_scale_one = 1u << 16;
+#ifdef USB_LED_MICROBENCH
+    // the parser stages are measured in place
+    friend int run_microbench(arguments_t const &arguments);
+#endif
+    // one usbmon device per captured bus, bus 0 captures all of them
+    struct Bus {
+        int      number             = 0;
+        int      fd                 = -1;
+        // memory mapped ring of the binary api, nullptr if only the legacy read() is available
+        unsigned char *ring         = nullptr;
+        size_t         ring_size    = 0;
+        // total bytes since start, only written by the capture thread
+        alignas(64) atomic<uint64_t> total_bytes{ 0 };
+        // only used by the pwm thread
+        alignas(64) uint64_t last_total_bytes   = 0;
+        uint64_t             last_periode_bytes = 0;
+    };
+    // byte counter of a led channel
+    struct Counter {
+        // total bytes since start, only written by the capture thread
+        alignas(64) atomic<uint64_t> total_bytes{ 0 };
+        // only used by the pwm thread
+        alignas(64) uint64_t last_total_bytes = 0;
+    };
+private:
+    // channel masks of a bus and device, indexed by the traffic class: direction (0 out, 1 in) * 4 + transfer type
+    using route_t = array<uint32_t, 8>;
+
+    int             epoll_fd = -1;
+    int             stop_fd  = -1;
+    int             wake_fd  = -1;
+    vector<Bus>     buses;
+    vector<Counter> counters;
+    vector<route_t> routes;
+    uint32_t        offsets[batch_size];
+    uint32_t        batch_bytes[batch_size];
+    uint64_t        pending[Config::max_channels];
+    uint64_t        pending_traffic[8];
+    std::thread     capture;
+    Stats          &stats;
+    uint64_t        wakeup_events = 0;
+    TraceWriter    *trace = nullptr;        // records every fetched event if set
+    uint64_t        interval_events = 0;    // events fetched since the last drop query
+    timepoint_t     next_stats_query{};
+    // captured plus dropped per captured event of the last query interval, read by the pwm thread
+    atomic<uint32_t> drop_scale{ drop_scale_one };
+    // set by an idle pwm thread, the capture thread signals the wake_fd on the next traffic
+    atomic<bool>    wake_armed{ false };
+    // benchmark replay and busy poll
+    atomic<bool>     stopping{ false };
+    atomic<uint64_t> replayed_events{ 0 };
+    atomic<int64_t>  replay_cpu_ns{ 0 };
+public:
+    UsbMon(vector<int> const &bus_numbers, vector<Channel> const &channels, uint32_t ring_size, Stats &s) 
+        : buses(bus_numbers.size()), counters(channels.size()), routes((max_buses + 1) * max_devices), stats{ s } {
+        epoll_fd = epoll_create1(0);
+        stop_fd  = eventfd(0, 0);
+        wake_fd  = eventfd(0, EFD_NONBLOCK);
+        if (epoll_fd == -1 || stop_fd == -1 || wake_fd == -1) {
+            cerr << "Cannot create epoll instance!\n";
+            exit(-1);
+        }
+        watch(stop_fd, stop_tag);
+        for (size_t i = 0; i < buses.size(); ++i)
+            open_bus(buses[i], bus_numbers[i], i, ring_size);
+        for (size_t i = 0; i < channels.size(); ++i) {
+            if (!channels[i].is_counter())
+                add_route(channels[i], i);
+        }
     }
-    return cfg;   
-}
+    ~UsbMon() {
+        stop();
+        for (auto &bus : buses) {
+            if (bus.ring != nullptr)
+                munmap(bus.ring, bus.ring_size);
+            close(bus.fd);
+        }
+        close(wake_fd);
+        close(stop_fd);
+        close(epoll_fd);
+    }
+    UsbMon(UsbMon const &) = delete;
+    UsbMon &operator=(UsbMon const &) = delete;
 
-int main(int argc, char *argv[]) {
-    Config cfg = parse_arguments(arguments_t(argv + 1, argv + argc));
-    cfg.print();
-    cfg.calculate_periode_values();
-    if (cfg.led_pins.empty())
-        cfg.led_pins.push_back(17); // default
+    // stop and join the capture thread
+    void stop() noexcept {
+        if (capture.joinable()) {
+            stopping = true;
+            uint64_t one = 1;
+            (void)!write(stop_fd, &one, sizeof(one));
+            capture.join();
+        }
+    }
+    // record every captured event to the trace, set before the start
+    void record_to(TraceWriter &writer) noexcept {
+        trace = &writer;
+    }
+    // start the capture thread, a priority above 0 runs it with SCHED_FIFO. with busy poll the thread spins
+    // over the devices and never sleeps, it needs a cpu of its own
+    void start(int cpu, int priority, bool busypoll) {
+        capture = std::thread{ [this, priority, busypoll] { make_realtime(priority); busypoll ? run_busypoll() : run(); } };
+        pin_to_cpu(capture.native_handle(), cpu);
+    }
+    // start the capture thread feeding the parser with replayed events, a rate of 0 replays as fast as possible
+    void start_replay(Replay const &replay, uint64_t rate, int cpu, int priority) {
+        capture = std::thread{ [this, &replay, rate, priority] { make_realtime(priority); run_replay(replay, rate); } };
+        pin_to_cpu(capture.native_handle(), cpu);
+    }
+    // events replayed and cpu time used by the replay, valid after stop()
+    uint64_t get_replayed_events() const noexcept {
+        return replayed_events.load();
+    }
+    chrono::nanoseconds get_replay_cpu_time() const noexcept {
+        return chrono::nanoseconds(replay_cpu_ns.load());
+    }
+    // true if the events of all buses are fetched in batches from the mapped ring
+    bool is_batched() const noexcept {
+        return all_of(buses.begin(), buses.end(), [](auto const &bus) { return bus.ring != nullptr; });
+    }
+    vector<Bus> const &get_buses() const noexcept {
+        return buses;
+    }
+    // the bytes of all buses since the last call, never blocks the caller
+    uint64_t get_periode_bytes() noexcept {
+        uint64_t bytes = 0;
+        for (auto &bus : buses) {
+            auto total = bus.total_bytes.load(memory_order_relaxed);
+            bus.last_periode_bytes = total - exchange(bus.last_total_bytes, total);
+            bytes += bus.last_periode_bytes;
+        }
+        return bytes;
+    }
+    // readable after arm_wake() as soon as a channel sees traffic
+    int get_wake_fd() const noexcept {
+        return wake_fd;
+    }
+    // ask the capture thread for a wakeup on the next traffic, false if traffic arrived since the last
+    // get_channel_bytes() and waiting would miss it
+    bool arm_wake() noexcept {
+        wake_armed.store(true, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        for (auto const &counter : counters) {
+            if (counter.total_bytes.load(memory_order_relaxed) != counter.last_total_bytes) {
+                wake_armed.store(false, memory_order_relaxed);
+                return false;
+            }
+        }
+        return true;
+    }
+    // the factor (fixed point, drop_scale_one is 1.0) of the events usbmon saw to the events captured in the
+    // last query interval, 1.0 if nothing was dropped
+    uint32_t get_drop_scale() const noexcept {
+        return drop_scale.load(memory_order_relaxed);
+    }
+    // the bytes of a channel since the start, any thread may read it
+    uint64_t get_channel_total(size_t channel) const noexcept {
+        return counters[channel].total_bytes.load(memory_order_relaxed);
+    }
+    // the bytes of a channel since the last call, never blocks the caller
+    uint64_t get_channel_bytes(size_t channel) noexcept {
+        auto &counter = counters[channel];
+        auto total    = counter.total_bytes.load(memory_order_relaxed);
+        return total - exchange(counter.last_total_bytes, total);
+    }
+private:
+    static constexpr int short_status = -121;  // -EREMOTEIO, a short transfer
+
+    void watch(int fd, uint32_t tag) {
+        epoll_event event{};
+        event.events   = EPOLLIN;
+        event.data.u32 = tag;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+            cerr << "Cannot watch file descriptor " << fd << "!\n";
+            exit(-1);
+        }
+    }
+
+    void open_bus(Bus &bus, int number, size_t index, uint32_t ring_size) {
+        auto path = "/dev/usbmon" + to_string(number);
+        bus.number = number;
+        // non-blocking, so a fetch never waits inside the kernel and the loop keeps serving the other buses and the stop
+        bus.fd     = open(path.c_str(), O_RDONLY | O_NONBLOCK);
+        if (bus.fd == -1) {
+            cerr << "Cannot open usbmon device " << path << "! forget sudo or modprobe? (\"sudo modprobe usbmon\") \n";
+            exit(-1);
+        }
+        // the ring can only be resized before it is mapped
+        if (ring_size != 0 && ioctl(bus.fd, MON_IOCT_RING_SIZE, ring_size) == -1) {
+            cerr << "Cannot resize the usbmon ring of " << path << " to " << ring_size << " bytes! (" << strerror(errno) << ")\n";
+            exit(-1);
+        }
+        map_ring(bus);
+        watch(bus.fd, static_cast<uint32_t>(index));
+    }
+
+    // set the channel bit in every table entry matched by the channel, a bus above max_buses is routed by
+    // the shared last row like its events
+    void add_route(Channel const &ch, size_t index) noexcept {
+        auto bus          = min<size_t>(ch.bus, max_buses);
+        auto bus_range    = ch.bus    < 0 ? pair<size_t, size_t>{ 0, max_buses + 1 } : pair<size_t, size_t>{ bus, bus + 1 };
+        auto device_range = ch.device < 0 ? pair<size_t, size_t>{ 0, max_devices }   : pair<size_t, size_t>{ ch.device, ch.device + 1 };
+        for (auto b = bus_range.first; b < bus_range.second; ++b) {
+            for (auto d = device_range.first; d < device_range.second; ++d) {
+                auto &route = routes[b * max_devices + d];
+                for (int type = 0; type < 4; ++type) {
+                    if ((ch.types & (1u << type)) == 0)
+                        continue;
+                    if (ch.direction != Channel::Direction::In)
+                        route[type] |= 1u << index;
+                    if (ch.direction != Channel::Direction::Out)
+                        route[4 + type] |= 1u << index;
+                }
+            }
+        }
+    }
+
+    // map the kernel ring buffer, keep the legacy read() if the kernel refuses
+    static void map_ring(Bus &bus) noexcept {
+        int size = ioctl(bus.fd, MON_IOCQ_RING_SIZE);
+        if (size <= 0)
+            return;
+        void *mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, bus.fd, 0);
+        if (mapped == MAP_FAILED)
+            return;
+        bus.ring      = static_cast<unsigned char *>(mapped);
+        bus.ring_size = size;
+    }
+
+    // the byte count of a single event header. a submission and its callback carry the same transfer,
+    // only the successful or short callbacks are counted with the actual length. ring filler events
+    // and errors count zero bytes, selected without branches
+    static uint32_t event_bytes(mon_bin_hdr const &header) noexcept {
+        bool counted = (header.type == 'C') & ((header.status == 0) | (header.status == short_status));
+        return counted ? header.len_urb : 0;
+    }
+    // a trace record already holds the counted bytes
+    static uint32_t event_bytes(trace_record const &record) noexcept {
+        return record.len_urb;
+    }
+
+    // account a batch of events, header(i) gives the i-th header in place. the lengths are summed in
+    // a first pass unrolled by four, so the header loads are independent of the routing stores
+    template<typename Header>
+    uint64_t account_batch(uint32_t count, Header const &header) noexcept {
+        uint64_t sum[4] = {};
+        uint32_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            sum[0] += batch_bytes[i]     = event_bytes(header(i));
+            sum[1] += batch_bytes[i + 1] = event_bytes(header(i + 1));
+            sum[2] += batch_bytes[i + 2] = event_bytes(header(i + 2));
+            sum[3] += batch_bytes[i + 3] = event_bytes(header(i + 3));
+        }
+        for (; i < count; ++i)
+            sum[0] += batch_bytes[i] = event_bytes(header(i));
+        for (i = 0; i < count; ++i)
+            route_event(header(i), batch_bytes[i]);
+        return sum[0] + sum[1] + sum[2] + sum[3];
+    }
+
+    // add the bytes of an event to its traffic class and to all channels it is routed to
+    template<typename Event>
+    void route_event(Event const &header, uint64_t bytes) noexcept {
+        auto bus = min<size_t>(header.busnum, max_buses);
+        auto dev = header.devnum & (max_devices - 1);
+        auto cls = ((header.epnum >> 7) << 2) | (header.xfer_type & 3);
+        pending_traffic[cls] += bytes;
+        auto &device = stats.device_bytes[bus * max_devices + dev];
+        device.store(device.load(memory_order_relaxed) + bytes, memory_order_relaxed);
+        for (auto mask = routes[bus * max_devices + dev][cls]; mask != 0; mask &= mask - 1)
+            pending[__builtin_ctz(mask)] += bytes;
+    }
+
+    // make the pending channel bytes visible to the pwm thread
+    void publish_pending() noexcept {
+        uint64_t published = 0;
+        for (size_t i = 0; i < counters.size(); ++i) {
+            auto &total = counters[i].total_bytes;
+            published  += pending[i];
+            total.store(total.load(memory_order_relaxed) + exchange(pending[i], 0), memory_order_relaxed);
+        }
+        // pairs with the fence of arm_wake(), either the pwm thread sees the new total or we see the flag
+        if (published != 0) {
+            atomic_thread_fence(memory_order_seq_cst);
+            if (wake_armed.load(memory_order_relaxed) && wake_armed.exchange(false, memory_order_relaxed)) {
+                uint64_t one = 1;
+                (void)!write(wake_fd, &one, sizeof(one));
+            }
+        }
+        for (size_t i = 0; i < stats.traffic_bytes.size(); ++i) {
+            auto &total = stats.traffic_bytes[i];
+            total.store(total.load(memory_order_relaxed) + exchange(pending_traffic[i], 0), memory_order_relaxed);
+        }
+    }
+
+    // capture thread, drain every bus that got events until stopped
+    void run() noexcept {
+        epoll_event events[max_wait];
+        fill(begin(pending), end(pending), 0);
+        fill(begin(pending_traffic), end(pending_traffic), 0);
+        AllocationCheck allocations{ stats.capture_allocations };
+        for (;;) {
+            int ready = epoll_wait(epoll_fd, events, max_wait, -1);
+            wakeup_events = 0;
+            for (int i = 0; i < ready; ++i) {
+                if (events[i].data.u32 == stop_tag)
+                    return;
+                auto &bus  = buses[events[i].data.u32];
+                auto bytes = bus.ring != nullptr ? fetch_batch(bus) : read_single(bus);
+                bus.total_bytes.store(bus.total_bytes.load(memory_order_relaxed) + bytes, memory_order_relaxed);
+            }
+            publish_pending();
+            stats.events_per_wakeup.record(wakeup_events);
+            if (trace != nullptr)
+                trace->flush_due(now());
+            interval_events += wakeup_events;
+            query_drops();
+            allocations.verify();
+        }
+    }
+
+    // capture thread of the busy poll mode, polls every bus without blocking until stopped. the wakeup
+    // latency of epoll_wait is gone, the event latency shows what is left
+    void run_busypoll() noexcept {
+        fill(begin(pending), end(pending), 0);
+        fill(begin(pending_traffic), end(pending_traffic), 0);
+        AllocationCheck allocations{ stats.capture_allocations };
+        while (!stopping.load(memory_order_relaxed)) {
+            wakeup_events = 0;
+            for (auto &bus : buses) {
+                auto bytes = bus.ring != nullptr ? fetch_batch(bus) : read_single(bus);
+                bus.total_bytes.store(bus.total_bytes.load(memory_order_relaxed) + bytes, memory_order_relaxed);
+            }
+            if (wakeup_events == 0) {
+                cpu_relax();
+                continue;
+            }
+            publish_pending();
+            stats.events_per_wakeup.record(wakeup_events);
+            if (trace != nullptr)
+                trace->flush_due(now());
+            interval_events += wakeup_events;
+            query_drops();
+            allocations.verify();
+        }
+    }
+
+    // the age of an event by its usbmon timestamp, which is taken from the realtime clock
+    void record_latency(mon_bin_hdr const &header) noexcept {
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        auto age = (static_cast<int64_t>(ts.tv_sec) - header.ts_sec) * 1000000000 + ts.tv_nsec - int64_t{ header.ts_usec } * 1000;
+        stats.event_latency_ns.record(static_cast<uint64_t>(max<int64_t>(age, 0)));
+    }
+
+    // sum the events the kernel dropped since the last query and update the drop scale. a dropping
+    // reader is never idle, so querying on the wakeups is enough and costs no extra wakeup
+    void query_drops() noexcept {
+        auto tsc = now();
+        if (tsc < next_stats_query)
+            return;
+        next_stats_query = tsc + stats_interval;
+        uint64_t dropped = 0, queued = 0;
+        for (auto const &bus : buses) {
+            mon_bin_stats counts{};
+            if (ioctl(bus.fd, MON_IOCG_STATS, &counts) == -1)
+                continue;
+            dropped += counts.dropped;
+            queued   = max<uint64_t>(queued, counts.queued);
+        }
+        stats.usbmon_dropped.store(stats.usbmon_dropped.load(memory_order_relaxed) + dropped, memory_order_relaxed);
+        if (queued > stats.usbmon_queued_max.load(memory_order_relaxed))
+            stats.usbmon_queued_max.store(queued, memory_order_relaxed);
+        auto scale = interval_events != 0 ? (interval_events + dropped) * drop_scale_one / interval_events : drop_scale_one;
+        drop_scale.store(static_cast<uint32_t>(min<uint64_t>(scale, UINT32_MAX)), memory_order_relaxed);
+        interval_events = 0;
+    }
+
+    // benchmark thread, parse the replayed events in batches at the given rate
+    void run_replay(Replay const &replay, uint64_t rate) noexcept {
+        constexpr auto slice = 1ms;
+        fill(begin(pending), end(pending), 0);
+        fill(begin(pending_traffic), end(pending_traffic), 0);
+        AllocationCheck allocations{ stats.capture_allocations };
+        uint64_t events = 0;
+        auto start = now(), next = start;
+        while (!stopping.load(memory_order_relaxed)) {
+            auto due = rate == 0 ? events + batch_size : rate * chrono::duration_cast<chrono::nanoseconds>(next - start).count() / 1000000000;
+            stats.events_per_wakeup.record(due - events);
+            while (events < due) {
+                auto count   = static_cast<uint32_t>(min<uint64_t>({ due - events, batch_size, replay.contiguous(events) }));
+                if (auto traces = replay.trace(events)) {
+                    account_batch(count, [traces](uint32_t i) -> trace_record const & { return traces[i]; });
+                } else {
+                    auto records = replay.record(events);
+                    account_batch(count, [records](uint32_t i) -> mon_bin_hdr const & { return records[i]; });
+                }
+                events += count;
+            }
+            publish_pending();
+            allocations.verify();
+            if (rate != 0) {
+                next += slice;
+                this_thread::sleep_until(next);
+            }
+        }
+        timespec cpu;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+        replay_cpu_ns   = static_cast<int64_t>(cpu.tv_sec) * 1000000000 + cpu.tv_nsec;
+        replayed_events = events;
+    }
+
+    // fetch all pending events from the ring and release them once they are accounted
+    uint64_t fetch_batch(Bus &bus) noexcept {
+        mon_bin_mfetch fetch{ offsets, batch_size, 0 };
+        auto tsc = raw_ns();
+        int  ret = ioctl(bus.fd, MON_IOCX_MFETCH, &fetch);
+        // an empty fetch of a spurious wakeup or of the busy poll is not a syscall worth timing
+        if (ret == -1 && errno == EAGAIN)
+            return 0;
+        stats.syscall_ns.record(static_cast<uint64_t>(raw_ns() - tsc));
+        if (ret == -1 || fetch.nfetch == 0)
+            return 0;
+        wakeup_events += fetch.nfetch;
+
+        auto const *ring  = bus.ring;
+        auto        header = [this, ring](uint32_t i) -> mon_bin_hdr const & {
+            return *reinterpret_cast<mon_bin_hdr const *>(ring + offsets[i]);
+        };
+        record_latency(header(0));
+        auto bytes = account_batch(fetch.nfetch, header);
+        if (trace != nullptr) {
+            for (uint32_t i = 0; i < fetch.nfetch; ++i)
+                trace->push(header(i), batch_bytes[i]);
+        }
+        // events left in the ring keep the device readable, a flush deferred to the next fetch would wake
+        // the loop at once and block it in that fetch until new traffic arrives
+        ioctl(bus.fd, MON_IOCH_MFLUSH, fetch.nfetch);
+        return bytes;
+    }
+
+    // fallback for kernels without the binary api, one event per read()
+    uint64_t read_single(Bus const &bus) noexcept {
+        mon_bin_hdr header{};
+        auto tsc = raw_ns();
+        auto ret = read(bus.fd, &header, sizeof(header));
+        if (ret == -1 && errno == EAGAIN)
+            return 0;
+        stats.syscall_ns.record(static_cast<uint64_t>(raw_ns() - tsc));
+        // lagacy read only returns 48 bytes
+        if (ret != 48) 
+            return 0; 
+        wakeup_events += 1;
+        record_latency(header);
+        auto bytes = account_batch(1, [&header](uint32_t) -> mon_bin_hdr const & { return header; });
+        if (trace != nullptr)
+            trace->push(header, batch_bytes[0]);
+        return bytes;
+    }
+};
+
+// event loop of the pwm thread, waits for absolute deadlines of a timerfd so the edges stay on a fixed grid
+class Scheduler {
+    static constexpr uint32_t timer_tag = 0;
+    static constexpr uint32_t wake_tag  = 1;
+    static constexpr uint32_t stop_tag  = 2;
+
+    int             epoll_fd = -1;
+    int             timer_fd = -1;
+    Stats          &stats;
+    Histogram      &lateness;
+    AllocationCheck allocations;
+public:
+    Scheduler(Stats &s) : stats{ s }, lateness{ s.lateness_ns }, allocations{ s.pwm_allocations } {
+        epoll_fd = epoll_create1(0);
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+        epoll_event event{};
+        event.events   = EPOLLIN;
+        event.data.u32 = timer_tag;
+        if (epoll_fd == -1 || timer_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &event) == -1) {
+            cerr << "Cannot create timer!\n";
+            exit(-1);
+        }
+    }
+    ~Scheduler() {
+        close(timer_fd);
+        close(epoll_fd);
+    }
+    Scheduler(Scheduler const &) = delete;
+    Scheduler &operator=(Scheduler const &) = delete;
+
+    // the allocations of the pwm thread so far belong to the setup of a generator
+    void setup_done() noexcept {
+        allocations.reset();
+    }
+
+    // block until the deadline, returns immediately if it already passed. every edge checks that
+    // the pwm loop did not allocate since the setup
+    void wait_until(timepoint_t const &deadline) noexcept {
+        allocations.verify();
+        itimerspec spec{};
+        spec.it_value = to_timespec(deadline);
+        timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+        for (;;) {
+            epoll_event event;
+            if (epoll_wait(epoll_fd, &event, 1, -1) == 1 && event.data.u32 == timer_tag) {
+                uint64_t expirations;
+                (void)!read(timer_fd, &expirations, sizeof(expirations));
+                break;
+            }
+        }
+        lateness.record(chrono::duration_cast<chrono::nanoseconds>(now() - deadline).count());
+    }
+
+    // block without a timeout until the wake fd or the stop fd is signaled or the given timepoint passed,
+    // returns the timepoint of the wakeup. the skipped period wakeups are counted as saved
+    timepoint_t sleep_until_wake(int wake_fd, int stop_fd, timepoint_t const &until, duration_t periode) noexcept {
+        epoll_event event{};
+        event.events   = EPOLLIN;
+        event.data.u32 = wake_tag;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event);
+        event.data.u32 = stop_tag;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &event);
+        itimerspec spec{};
+        if (until != timepoint_t::max())
+            spec.it_value = to_timespec(until);
+        timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+
+        stats.idle_entries.store(stats.idle_entries.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        auto start = now();
+        while (epoll_wait(epoll_fd, &event, 1, -1) != 1)
+            ;
+        // the stop fd stays readable, the loop ends anyway
+        uint64_t value;
+        if (event.data.u32 != stop_tag)
+            (void)!read(event.data.u32 == wake_tag ? wake_fd : timer_fd, &value, sizeof(value));
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, wake_fd, nullptr);
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, stop_fd, nullptr);
+
+        auto woken = now();
+        auto slept = woken - start;
+        stats.idle_ns.store(stats.idle_ns.load(memory_order_relaxed) + chrono::duration_cast<chrono::nanoseconds>(slept).count(), memory_order_relaxed);
+        stats.idle_saved_wakeups.store(stats.idle_saved_wakeups.load(memory_order_relaxed) + slept / periode, memory_order_relaxed);
+        return woken;
+    }
+};
+
+// the led sinks switch the pins of the on mask on and the ones of the off mask off with a single call.
+// the sink is a template parameter of the generator, so the hot path has no virtual dispatch
+template<typename Sink, typename = void>
+struct is_led_sink : false_type {};
+template<typename Sink>
+struct is_led_sink<Sink, void_t<decltype(declval<Sink const &>().write(uint32_t{}, uint32_t{}))>> : true_type {};
+
+// drives the pins through wiringPi, a no-op without USING_WIRING_PI
+class Raspi {
+    uint32_t pins;
+    bool     inverted;
+public:
+    Raspi(std::vector<int> const &p, bool inv) : pins{ 0 }, inverted{ inv } {
+        for (auto &pin : p)
+            pins |= 1u << pin;
+        #ifdef USING_WIRING_PI
+            wiringPiSetupGpio();
+            for (auto &pin : p)
+                pinMode(pin, OUTPUT);
+        #endif
+    }
+    // switch the led of the pins in the on mask on and the ones in the off mask off
+    void write(uint32_t on, uint32_t off) const noexcept {
+        #ifdef USING_WIRING_PI
+            if (inverted)
+                swap(on, off);
+            for (auto mask = on & pins; mask != 0; mask &= mask - 1)
+                digitalWrite(__builtin_ctz(mask), HIGH);
+            for (auto mask = off & pins; mask != 0; mask &= mask - 1)
+                digitalWrite(__builtin_ctz(mask), LOW);
+        #endif
+    }
+};
+
+#ifdef USING_LIBGPIOD
+// drives the pins through the gpio character device with libgpiod (v1 api). all pins are requested as one
+// bulk and every write sets all of them with a single ioctl, works on every Pi including the Pi 5
+class Gpiod {
+    gpiod_chip             *chip = nullptr;
+    mutable gpiod_line_bulk bulk{};
+    std::vector<int>        pins;       // in the order of the bulk
+    mutable std::vector<int> values;
+    mutable uint32_t        state = 0;
+    uint32_t                mask  = 0;
+    bool                    inverted;
+public:
+    Gpiod(std::vector<int> const &p, bool inv, std::string const &chip_name) : pins{ p }, values(p.size()), inverted{ inv } {
+        std::vector<unsigned int> offsets(pins.begin(), pins.end());
+        for (auto pin : pins)
+            mask |= 1u << pin;
+        chip = gpiod_chip_open_by_name(chip_name.c_str());
+        if (chip == nullptr || gpiod_chip_get_lines(chip, offsets.data(), offsets.size(), &bulk) != 0) {
+            cerr << "Cannot open the gpio lines of " << chip_name << "!\n";
+            exit(-1);
+        }
+        for (auto &value : values)
+            value = inverted ? 1 : 0;
+        if (gpiod_line_request_bulk_output(&bulk, "usb_led", values.data()) != 0) {
+            cerr << "Cannot request the gpio lines of " << chip_name << "! (used by another process?)\n";
+            exit(-1);
+        }
+    }
+    ~Gpiod() {
+        gpiod_line_release_bulk(&bulk);
+        gpiod_chip_close(chip);
+    }
+    Gpiod(Gpiod const &) = delete;
+    Gpiod &operator=(Gpiod const &) = delete;
+
+    void write(uint32_t on, uint32_t off) const noexcept {
+        auto next = (state | on) & ~off & mask;
+        if (next == state)
+            return;
+        state = next;
+        for (size_t i = 0; i < pins.size(); ++i)
+            values[i] = static_cast<int>(((state >> pins[i]) & 1) ^ inverted);
+        gpiod_line_set_value_bulk(&bulk, values.data());
+    }
+};
+#endif
+
+// discards the edges, gives a measurable loop without any gpio (e.g. the benchmark or the no_pi build).
+// counts the writes and the switched pins into the statistics
+class NullSink {
+    Stats &stats;
+public:
+    NullSink(Stats &s) : stats{ s } {}
+
+    void write(uint32_t on, uint32_t off) const noexcept {
+        stats.null_writes.store(stats.null_writes.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        stats.null_switches.store(stats.null_switches.load(memory_order_relaxed) + __builtin_popcount(on) + __builtin_popcount(off), memory_order_relaxed);
+    }
+};
+
+// drives the pins through the gpio registers mapped from /dev/gpiomem (Raspberry Pi 1-4),
+// all pins of a mask switch with a single store to GPSET0 or GPCLR0
+class GpioMem {
+    static constexpr size_t   block_size = 4096;
+    static constexpr size_t   gpfsel0    = 0x00 / sizeof(uint32_t);
+    static constexpr size_t   gpset0     = 0x1c / sizeof(uint32_t);
+    static constexpr size_t   gpclr0     = 0x28 / sizeof(uint32_t);
+    static constexpr uint32_t fsel_out   = 0b001;
+
+    volatile uint32_t *gpio = nullptr;
+    uint32_t           pins = 0;
+    bool               inverted;
+public:
+    GpioMem(std::vector<int> const &p, bool inv) : inverted{ inv } {
+        int fd = open("/dev/gpiomem", O_RDWR | O_SYNC);
+        if (fd == -1) {
+            cerr << "Cannot open /dev/gpiomem!\n";
+            exit(-1);
+        }
+        void *mapped = mmap(nullptr, block_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            cerr << "Cannot map /dev/gpiomem!\n";
+            exit(-1);
+        }
+        gpio = static_cast<volatile uint32_t *>(mapped);
+        // every function select register holds 3 bits of 10 pins
+        for (auto &pin : p) {
+            auto &fsel  = gpio[gpfsel0 + pin / 10];
+            auto  shift = (pin % 10) * 3;
+            fsel = (fsel & ~(0b111u << shift)) | (fsel_out << shift);
+            pins |= 1u << pin;
+        }
+    }
+    ~GpioMem() {
+        munmap(const_cast<uint32_t *>(gpio), block_size);
+    }
+    GpioMem(GpioMem const &) = delete;
+    GpioMem &operator=(GpioMem const &) = delete;
+
+    // switch the led of the pins in the on mask on and the ones in the off mask off
+    void write(uint32_t on, uint32_t off) const noexcept {
+        if (inverted)
+            swap(on, off);
+        if (on & pins)
+            gpio[gpset0] = on & pins;
+        if (off & pins)
+            gpio[gpclr0] = off & pins;
+    }
+};
+
+// drives the hardware pwm channels through /sys/class/pwm, the pins need the pwm function ("dtoverlay=pwm-2chan")
+class HardwarePwm {
+    static constexpr size_t pwm_channels = 2;
+
+    // duty cycle file and led channel of every used pwm channel
+    std::vector<pair<int, size_t>> duty_fds;
+    std::vector<std::string>       channel_paths;
+    bool                           inverted;
+    duration_t                     periode;
+public:
+    HardwarePwm(std::vector<Channel> const &leds, bool inv, duration_t per, int chip) : inverted{ inv }, periode{ per } {
+        auto chip_path = "/sys/class/pwm/pwmchip" + to_string(chip);
+        optional<size_t> owner[pwm_channels];
+        for (size_t led = 0; led < leds.size(); ++led) {
+            for (auto &p : leds[led].pins) {
+                auto channel = pwm_channel(p);
+                if (channel < 0) {
+                    cerr << "Pin " << p << " has no hardware pwm channel! use one of 12, 13, 18 or 19\n";
+                    exit(-1);
+                }
+                if (owner[channel] && *owner[channel] != led) {
+                    cerr << "Hardware pwm channel " << channel << " (pin " << p << ") is used by two mappings!\n";
+                    exit(-1);
+                }
+                owner[channel] = led;
+            }
+        }
+        for (size_t channel = 0; channel < pwm_channels; ++channel) {
+            if (!owner[channel])
+                continue;
+            auto channel_path = chip_path + "/pwm" + to_string(channel);
+            // exporting an already exported channel fails, the channel is usable anyway
+            write_file(chip_path + "/export", channel);
+            // the duty cycle must never exceed the period, so clear it before the period is set
+            if (!write_file(channel_path + "/duty_cycle", 0) 
+                || !write_file(channel_path + "/period", chrono::nanoseconds(periode).count())
+                || !write_file(channel_path + "/enable", 1)) {
+                cerr << "Cannot setup hardware pwm " << channel_path << "!\n";
+                exit(-1);
+            }
+            duty_fds.emplace_back(open((channel_path + "/duty_cycle").c_str(), O_WRONLY), *owner[channel]);
+            channel_paths.push_back(channel_path);
+            if (duty_fds.back().first == -1) {
+                cerr << "Cannot open " << channel_path << "/duty_cycle!\n";
+                exit(-1);
+            }
+        }
+    }
+    ~HardwarePwm() {
+        for (auto [fd, led] : duty_fds)
+            close(fd);
+    }
+    HardwarePwm(HardwarePwm const &) = delete;
+    HardwarePwm &operator=(HardwarePwm const &) = delete;
+
+    // change the period of all used channels, the duty cycle is cleared first so it never exceeds the period
+    void set_periode(duration_t per) noexcept {
+        if (per == periode)
+            return;
+        periode = per;
+        for (auto const &path : channel_paths) {
+            if (!write_file(path + "/duty_cycle", 0) || !write_file(path + "/period", chrono::nanoseconds(periode).count()))
+                cerr << "Cannot change hardware pwm period of " << path << "!\n";
+        }
+    }
+    // set the high time of the next periods of a led channel, the hardware generates the edges
+    void set_duty(size_t channel, duration_t high) const noexcept {
+        auto duty = chrono::nanoseconds(inverted ? periode - high : high).count();
+        char buffer[24];
+        auto [p, ec] = to_chars(begin(buffer), end(buffer), duty);
+        for (auto [fd, led] : duty_fds) {
+            if (led == channel)
+                (void)!pwrite(fd, buffer, p - buffer, 0);
+        }
+    }
+private:
+    // pwm0 is available on BCM 12 and 18, pwm1 on BCM 13 and 19
+    static int pwm_channel(int pin) noexcept {
+        switch (pin) {
+            case 12: case 18: return 0;
+            case 13: case 19: return 1;
+            default:          return -1;
+        }
+    }
+
+    // the channel directory is created asynchronously after the export, retry for a short while
+    template<typename T>
+    static bool write_file(std::string const &path, T value) noexcept {
+        auto text = to_string(value);
+        for (int retry = 0; retry < 20; ++retry) {
+            int fd = open(path.c_str(), O_WRONLY);
+            if (fd != -1) {
+                bool written = write(fd, text.data(), text.size()) == static_cast<ssize_t>(text.size());
+                close(fd);
+                return written;
+            }
+            this_thread::sleep_for(10ms);
+        }
+        return false;
+    }
+};
+
+// non blocking logging sink, the pwm thread pushes fixed size records into a preallocated ring and
+// a background thread formats and writes them. records are dropped if the ring is full
+class Logger {
+public:
+    static constexpr uint64_t no_estimate = UINT64_MAX;
+    struct Record {
+        enum class Kind : int32_t { Periode, Channel, Bus, Startup };
+        Kind     kind;
+        int32_t  index;
+        uint64_t bytes;
+        uint64_t estimate;   // no_estimate if the rate is not smoothed
+        int64_t  nominal_ns;
+        int64_t  periode_ns;
+        int64_t  high_ns;
+        int64_t  low_ns;
+        int64_t  drift_ns;
+    };
+private:
+    static constexpr size_t capacity = 1024;
+    static constexpr auto   interval = 20ms;
+    static constexpr auto   top_interval = 1s;   // the top talkers are printed at most this often
+
+    array<Record, capacity> ring;
+    // head is only written by the producer, tail only by the consumer
+    alignas(64) atomic<size_t> head{ 0 };
+    alignas(64) atomic<size_t> tail{ 0 };
+    Stats       &stats;
+    atomic<bool> stopping{ false };
+    std::thread  writer;
+    vector<uint64_t> device_bytes;   // device counters at the last top talkers line
+public:
+    Logger(bool enabled, Stats &s) : stats{ s }, device_bytes(s.device_bytes.size()) {
+        if (enabled)
+            writer = std::thread{ [this] { run(); } };
+    }
+    ~Logger() {
+        if (writer.joinable()) {
+            stopping = true;
+            writer.join();
+        }
+    }
+    Logger(Logger const &) = delete;
+    Logger &operator=(Logger const &) = delete;
+
+    // never blocks, the record is dropped if the writer fell behind
+    void push(Record const &record) noexcept {
+        auto h = head.load(memory_order_relaxed);
+        if (h - tail.load(memory_order_acquire) == capacity) {
+            stats.dropped_log_records.store(stats.dropped_log_records.load(memory_order_relaxed) + 1, memory_order_relaxed);
+            return;
+        }
+        ring[h % capacity] = record;
+        head.store(h + 1, memory_order_release);
+    }
+private:
+    static void print(Record const &r) noexcept {
+        auto to_rate = [&r](uint64_t bytes) { return bytes / (r.nominal_ns / 1e9) / 1024.0; };
+        auto rate    = to_rate(r.bytes);
+        char estimate[32] = "";
+        if (r.estimate != no_estimate)
+            snprintf(estimate, sizeof(estimate), "   Est: %9.3f kb/s", to_rate(r.estimate));
+        switch (r.kind) {
+            case Record::Kind::Periode:
+                printf("Rate: %9.3f kb/s   PWM: %6.3f s   [H: %6.3f s   L:%6.3f s]   Drift: %+.6f s%s\n", 
+                    rate, r.periode_ns / 1e9, r.high_ns / 1e9, r.low_ns / 1e9, r.drift_ns / 1e9, estimate);
+                break;
+            case Record::Kind::Channel:
+                printf("    Channel %d: %9.3f kb/s   [H: %6.3f s   L:%6.3f s]%s\n", r.index, rate, r.high_ns / 1e9, r.low_ns / 1e9, estimate);
+                break;
+            case Record::Kind::Bus:
+                printf("    Bus %d: %9.3f kb/s\n", r.index, rate);
+                break;
+            case Record::Kind::Startup:
+                printf("Startup: parse %.3f ms   usbmon %.3f ms   output setup %.3f ms (waited %.3f ms)   first edge %.3f ms\n",
+                    r.nominal_ns / 1e6, r.periode_ns / 1e6, r.high_ns / 1e6, r.low_ns / 1e6, r.drift_ns / 1e6);
+                break;
+        }
+    }
+
+    // format and write everything queued, report new drops
+    void drain(uint64_t &reported_drops, uint64_t &reported_usbmon_drops) noexcept {
+        auto t = tail.load(memory_order_relaxed);
+        auto h = head.load(memory_order_acquire);
+        for (; t != h; ++t)
+            print(ring[t % capacity]);
+        tail.store(t, memory_order_release);
+        auto drops = stats.dropped_log_records.load(memory_order_relaxed);
+        if (drops != reported_drops) {
+            printf("Log: %llu records dropped\n", static_cast<unsigned long long>(drops - reported_drops));
+            reported_drops = drops;
+        }
+        auto usbmon_drops = stats.usbmon_dropped.load(memory_order_relaxed);
+        if (usbmon_drops != reported_usbmon_drops) {
+            printf("Usbmon: %llu events dropped (queued max %llu)\n", static_cast<unsigned long long>(usbmon_drops - reported_usbmon_drops),
+                   static_cast<unsigned long long>(stats.usbmon_queued_max.load(memory_order_relaxed)));
+            reported_usbmon_drops = usbmon_drops;
+        }
+        fflush(stdout);
+    }
+
+    // the devices with the most traffic since the last line, nothing if there was none
+    void print_top(double seconds) {
+        auto talkers = stats.top_talkers(stats.top_devices, device_bytes.data());
+        if (talkers.empty())
+            return;
+        printf("Top:");
+        for (auto const &talker : talkers)
+            printf("   %u-%u %9.3f kb/s", talker.slot / static_cast<uint32_t>(Stats::device_numbers),
+                talker.slot % static_cast<uint32_t>(Stats::device_numbers), talker.bytes / seconds / 1024.0);
+        printf("\n");
+    }
+
+    void run() noexcept {
+        uint64_t reported_drops = 0, reported_usbmon_drops = 0;
+        auto last_top = now();
+        while (!stopping.load(memory_order_relaxed)) {
+            drain(reported_drops, reported_usbmon_drops);
+            if (stats.top_devices != 0 && now() - last_top >= top_interval) {
+                auto time = now();
+                print_top(to_sec(time - exchange(last_top, time)));
+            }
+            this_thread::sleep_for(interval);
+        }
+        drain(reported_drops, reported_usbmon_drops);
+    }
+};
+
+// the startup breakdown, queued by the pwm thread once the first edge is written
+class StartupLog {
+    Logger        *logger = nullptr;    // nullptr without logging or once the record is queued
+    Logger::Record record{};
+    timepoint_t    main;
+public:
+    StartupLog(Logger *l, Logger::Record const &r, timepoint_t m) noexcept : logger{ l }, record{ r }, main{ m } {}
+
+    // pwm thread: after every write of the output, completes the record with the time to the first edge
+    void edge_written() noexcept {
+        if (logger == nullptr)
+            return;
+        record.drift_ns = static_cast<int64_t>(chrono::duration_cast<chrono::nanoseconds>(now() - main).count());
+        logger->push(record);
+        logger = nullptr;
+    }
+};
+
+// durations of a led channel in the current period
+struct ChannelPeriode {
+    size_t     channel;
+    uint64_t   bytes;
+    uint64_t   estimate;
+    duration_t high;
+    duration_t low;
+};
+
+// rate packet of the fleet mode, sent by a publishing host once per period. it carries the cumulative bytes of
+// every mapping, so a lost packet only delays the rate and loses no bytes. all fields are little endian
+struct RatePacket {
+    static constexpr uint32_t magic_value   = 0x4c425355;   // "USBL"
+    static constexpr uint16_t version_value = 1;
+    uint32_t magic;
+    uint16_t version;
+    uint16_t channels;
+    uint64_t sequence;
+    uint32_t run;           // random per start of the publisher, a new run restarts the sequence
+    uint32_t periode_us;
+    uint64_t totals[Config::max_channels];
+
+    static constexpr size_t size(size_t channels) noexcept {
+        return offsetof(RatePacket, totals) + channels * sizeof(uint64_t);
+    }
+};
+static_assert(offsetof(RatePacket, totals) == 24, "rate packet layout");
+
+// receives the rate packets of the publishing hosts on its own thread, the totals of the remote mappings are
+// published lock free. the totals start at zero with the first packet of a host and continue across a
+// restart of the host, so the pwm thread only sees the differences
+class RateReceiver {
+    static constexpr uint32_t socket_tag = 0;
+    static constexpr uint32_t stop_tag   = 1;
+    struct Remote {
+        size_t   channel;           // the local mapping
+        in_addr  address;
+        uint16_t remote_channel;
+        bool     primed   = false;
+        uint32_t run      = 0;
+        uint64_t sequence = 0;
+        uint64_t baseline = 0;      // remote total at the local zero
+        alignas(64) atomic<uint64_t> total{ 0 };
+    };
+    std::vector<std::unique_ptr<Remote>> remotes;
+    int         epoll_fd  = -1;
+    int         socket_fd = -1;
+    int         stop_fd   = -1;
+    std::thread receiver;
+public:
+    RateReceiver(std::vector<Channel> const &channels, uint16_t port) {
+        for (size_t i = 0; i < channels.size(); ++i) {
+            if (channels[i].remote.empty())
+                continue;
+            auto remote = std::make_unique<Remote>();
+            remote->channel        = i;
+            remote->remote_channel = static_cast<uint16_t>(channels[i].remote_channel);
+            if (inet_pton(AF_INET, channels[i].remote.c_str(), &remote->address) != 1) {
+                cerr << "Invalid remote address " << channels[i].remote << "!\n";
+                exit(-1);
+            }
+            remotes.push_back(std::move(remote));
+        }
+        sockaddr_in address{};
+        address.sin_family      = AF_INET;
+        address.sin_port        = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        epoll_fd  = epoll_create1(0);
+        stop_fd   = eventfd(0, 0);
+        socket_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        epoll_event event{};
+        event.events   = EPOLLIN;
+        event.data.u32 = socket_tag;
+        if (epoll_fd == -1 || stop_fd == -1 || socket_fd == -1
+            || bind(socket_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == -1
+            || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, socket_fd, &event) == -1) {
+            cerr << "Cannot receive the rates on udp port " << port << "!\n";
+            exit(-1);
+        }
+        event.data.u32 = stop_tag;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &event);
+        receiver = std::thread{ [this] { run(); } };
+    }
+    ~RateReceiver() {
+        uint64_t one = 1;
+        (void)!write(stop_fd, &one, sizeof(one));
+        receiver.join();
+        close(socket_fd);
+        close(stop_fd);
+        close(epoll_fd);
+    }
+    RateReceiver(RateReceiver const &) = delete;
+    RateReceiver &operator=(RateReceiver const &) = delete;
+
+    // the received bytes of a remote mapping since the start, never blocks
+    uint64_t get_total(size_t channel) const noexcept {
+        for (auto const &remote : remotes) {
+            if (remote->channel == channel)
+                return remote->total.load(memory_order_relaxed);
+        }
+        return 0;
+    }
+private:
+    void run() noexcept {
+        RatePacket packet;
+        for (;;) {
+            epoll_event event;
+            if (epoll_wait(epoll_fd, &event, 1, -1) != 1)
+                continue;
+            if (event.data.u32 == stop_tag)
+                return;
+            sockaddr_in sender{};
+            socklen_t   sender_size = sizeof(sender);
+            auto size = recvfrom(socket_fd, &packet, sizeof(packet), MSG_DONTWAIT, reinterpret_cast<sockaddr *>(&sender), &sender_size);
+            // the fields are only decoded once the fixed part of the packet arrived
+            if (size < static_cast<ssize_t>(RatePacket::size(0)) || le32toh(packet.magic) != RatePacket::magic_value
+                || le16toh(packet.version) != RatePacket::version_value)
+                continue;
+            auto channels = le16toh(packet.channels);
+            if (channels > Config::max_channels || static_cast<size_t>(size) < RatePacket::size(channels))
+                continue;
+            for (auto &remote : remotes) {
+                if (remote->address.s_addr == sender.sin_addr.s_addr && remote->remote_channel < channels)
+                    update(*remote, le32toh(packet.run), le64toh(packet.sequence), le64toh(packet.totals[remote->remote_channel]));
+            }
+        }
+    }
+
+    // late and duplicated packets are dropped, a new run of the host continues from the local total
+    static void update(Remote &remote, uint32_t run, uint64_t sequence, uint64_t total) noexcept {
+        auto local = remote.total.load(memory_order_relaxed);
+        if (!remote.primed || run != remote.run)
+            remote.baseline = total - local;
+        else if (sequence > remote.sequence)
+            remote.total.store(total - remote.baseline, memory_order_relaxed);
+        else
+            return;
+        remote.primed   = true;
+        remote.run      = run;
+        remote.sequence = sequence;
+    }
+};
+
+// counts the traffic of the counter channels by the cumulative byte counters of sysfs instead of the events:
+// the network interfaces by /sys/class/net/<interface>/statistics, the block devices (e.g. usb disks) by
+// /sys/block/<device>/stat. the files are opened once and sampled by the pwm thread with a single pread()
+// per file and period, so the cost is per period and not per transfer. the remote mappings read the totals
+// of the rate receiver
+class CounterSource {
+    static constexpr uint64_t sector_size = 512;   // the block stat counts 512 byte sectors
+    struct Counter {
+        int      fds[2] = { -1, -1 };   // net: rx_bytes, tx_bytes; block: stat
+        bool     block  = false;
+        bool     read   = false;        // block: count the read and/or the written sectors
+        bool     write  = false;
+        bool     remote = false;
+        uint64_t last_total = 0;
+    };
+    std::vector<Counter> counters;  // indexed by the channel, all fds -1 for a usb channel
+    optional<RateReceiver> receiver;
+
+    static int open_counter(std::string const &path) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            cerr << "Cannot open the counter " << path << "!\n";
+            exit(-1);
+        }
+        return fd;
+    }
+    // the counters are printed as decimal numbers, sysfs regenerates them on every read at offset 0
+    static uint64_t read_counter(int fd) noexcept {
+        if (fd == -1)
+            return 0;
+        char buffer[32];
+        auto size  = pread(fd, buffer, sizeof(buffer), 0);
+        uint64_t value = 0;
+        if (size > 0)
+            from_chars(buffer, buffer + size, value);
+        return value;
+    }
+    // the block stat is one line of fields, the 3rd are the read and the 7th the written sectors
+    static uint64_t read_block(Counter const &counter) noexcept {
+        char buffer[256];
+        auto size = pread(counter.fds[0], buffer, sizeof(buffer), 0);
+        if (size <= 0)
+            return 0;
+        uint64_t fields[7]{};
+        char const *cur = buffer, *end = buffer + size;
+        for (auto &field : fields) {
+            while (cur < end && *cur == ' ')
+                ++cur;
+            cur = from_chars(cur, end, field).ptr;
+        }
+        return ((counter.read ? fields[2] : 0) + (counter.write ? fields[6] : 0)) * sector_size;
+    }
+    uint64_t read_total(size_t channel) const noexcept {
+        auto const &counter = counters[channel];
+        if (counter.remote)
+            return receiver->get_total(channel);
+        if (counter.block)
+            return read_block(counter);
+        return read_counter(counter.fds[0]) + read_counter(counter.fds[1]);
+    }
+public:
+    CounterSource(std::vector<Channel> const &channels, uint16_t subscribe_port) : counters(channels.size()) {
+        if (any_of(channels.begin(), channels.end(), [](auto const &ch) { return !ch.remote.empty(); }))
+            receiver.emplace(channels, subscribe_port);
+        for (size_t i = 0; i < channels.size(); ++i) {
+            auto const &ch      = channels[i];
+            auto       &counter = counters[i];
+            bool in  = ch.direction != Channel::Direction::Out;
+            bool out = ch.direction != Channel::Direction::In;
+            if (!ch.net.empty()) {
+                auto path = "/sys/class/net/" + ch.net + "/statistics/";
+                if (in)
+                    counter.fds[0] = open_counter(path + "rx_bytes");
+                if (out)
+                    counter.fds[1] = open_counter(path + "tx_bytes");
+            } else if (!ch.block.empty()) {
+                counter.fds[0] = open_counter("/sys/block/" + ch.block + "/stat");
+                counter.block  = true;
+                counter.read   = in;
+                counter.write  = out;
+            } else if (!ch.remote.empty()) {
+                counter.remote = true;
+            } else {
+                continue;
+            }
+            counter.last_total = read_total(i);
+        }
+    }
+    ~CounterSource() {
+        for (auto const &counter : counters) {
+            for (auto fd : counter.fds) {
+                if (fd != -1)
+                    close(fd);
+            }
+        }
+    }
+    CounterSource(CounterSource const &) = delete;
+    CounterSource &operator=(CounterSource const &) = delete;
+
+    bool is_counter_channel(size_t channel) const noexcept {
+        return counters[channel].fds[0] != -1 || counters[channel].fds[1] != -1 || counters[channel].remote;
+    }
+    // the bytes of a counter channel since the last call, a counter reset (e.g. a reloaded driver) counts nothing
+    uint64_t get_channel_bytes(size_t channel) noexcept {
+        auto &counter = counters[channel];
+        auto  total   = read_total(channel);
+        auto  last    = exchange(counter.last_total, total);
+        return total >= last ? total - last : 0;
+    }
+};
+
+// sends the cumulative bytes of the usb mappings to a consuming host once per period on its own thread.
+// the send never blocks, the capture and the pwm thread are never touched
+class RatePublisher {
+    UsbMon     &monitor;
+    size_t      channels;
+    duration_t  periode;
+    int         socket_fd = -1;
+    int         stop_fd   = -1;
+    std::thread publisher;
+public:
+    RatePublisher(Config const &cfg, UsbMon &m) : monitor{ m }, channels{ cfg.channels.size() }, periode{ cfg.pwm_periode } {
+        auto const &target = cfg.publish_target;
+        auto split = target.rfind(':');
+        addrinfo hints{}, *address = nullptr;
+        hints.ai_family   = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        if (split == std::string::npos
+            || getaddrinfo(target.substr(0, split).c_str(), target.substr(split + 1).c_str(), &hints, &address) != 0) {
+            cerr << "Invalid publish target " << target << "! (address:port)\n";
+            exit(-1);
+        }
+        socket_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        stop_fd   = eventfd(0, 0);
+        bool connected = socket_fd != -1 && connect(socket_fd, address->ai_addr, address->ai_addrlen) == 0;
+        freeaddrinfo(address);
+        if (!connected || stop_fd == -1) {
+            cerr << "Cannot publish the rates to " << target << "!\n";
+            exit(-1);
+        }
+        publisher = std::thread{ [this] { run(); } };
+    }
+    ~RatePublisher() {
+        uint64_t one = 1;
+        (void)!write(stop_fd, &one, sizeof(one));
+        publisher.join();
+        close(socket_fd);
+        close(stop_fd);
+    }
+    RatePublisher(RatePublisher const &) = delete;
+    RatePublisher &operator=(RatePublisher const &) = delete;
+private:
+    void run() noexcept {
+        RatePacket packet{};
+        packet.magic      = htole32(RatePacket::magic_value);
+        packet.version    = htole16(RatePacket::version_value);
+        packet.channels   = htole16(static_cast<uint16_t>(channels));
+        packet.run        = htole32(static_cast<uint32_t>(chrono::steady_clock::now().time_since_epoch().count() ^ getpid()));
+        packet.periode_us = htole32(static_cast<uint32_t>(periode.count()));
+        uint64_t sequence = 0;
+        pollfd stop{ stop_fd, POLLIN, 0 };
+        for (auto next = now() + periode;; next += periode) {
+            auto wait = chrono::duration_cast<chrono::milliseconds>(next - now()).count();
+            if (poll(&stop, 1, static_cast<int>(max<int64_t>(wait, 0))) != 0)
+                return;
+            packet.sequence = htole64(++sequence);
+            for (size_t c = 0; c < channels; ++c)
+                packet.totals[c] = htole64(monitor.get_channel_total(c));
+            (void)!send(socket_fd, &packet, RatePacket::size(channels), MSG_DONTWAIT);
+        }
+    }
+};
+
+// queue the rate lines of one period, drift is the offset of the period start to its grid position
+static void log_periode(Logger &logger, Config const &cfg, UsbMon &monitor, std::vector<ChannelPeriode> const &periodes,
+                        duration_t periode, timepoint_t::duration drift) noexcept {
+    using Kind  = Logger::Record::Kind;
+    auto ns     = [](auto d) { return static_cast<int64_t>(chrono::duration_cast<chrono::nanoseconds>(d).count()); };
+    // the rates of a channel are relative to its own period, the totals to the period of the first channel
+    auto nominal = *cfg.channels[periodes.front().channel].pwm_periode;
+    auto record  = [&](Kind kind, size_t index, uint64_t bytes, uint64_t estimate, duration_t high, duration_t low) {
+        if (cfg.estimate == Config::Estimate::Periode)
+            estimate = Logger::no_estimate;
+        auto channel_periode = kind == Kind::Channel ? *cfg.channels[index].pwm_periode : nominal;
+        logger.push({ kind, static_cast<int32_t>(index), bytes, estimate, ns(channel_periode), ns(periode), ns(high), ns(low), ns(drift) });
+    };
+    // the total of the captured buses, the channels may overlap, the benchmark replay has no buses
+    auto bytes = monitor.get_periode_bytes();
+    if (monitor.get_buses().empty()) {
+        for (auto const &p : periodes)
+            bytes += p.bytes;
+    }
+    auto const &first = periodes.front();
+    record(Kind::Periode, 0, bytes, first.estimate, first.high, first.low);
+    if (periodes.size() > 1) {
+        for (auto const &p : periodes)
+            record(Kind::Channel, p.channel, p.bytes, p.estimate, p.high, p.low);
+    }
+    if (monitor.get_buses().size() > 1) {
+        for (auto const &bus : monitor.get_buses())
+            record(Kind::Bus, bus.number, bus.last_periode_bytes, Logger::no_estimate, {}, {});
+    }
+}
+
+// the per channel state of the rate to duty mapping, owned by the pwm thread
+class PeriodeCalculator {
+    Config const          &cfg;
+    std::vector<Estimator> estimators;
+    std::vector<AutoRange> ranges;
+    std::vector<DutyTable> tables;
+public:
+    PeriodeCalculator(Config const &c) : cfg{ c } {
+        for (auto const &ch : cfg.channels) {
+            estimators.emplace_back(cfg, ch);
+            ranges.emplace_back(cfg, ch);
+            if (cfg.duty_table_levels != 0)
+                tables.emplace_back(cfg, ch, cfg.duty_table_levels);
+        }
+    }
+
+    // sample the channel counters and calculate the durations of the next period
+    void calculate(UsbMon &monitor, CounterSource &counters, std::vector<ChannelPeriode> &periodes) noexcept {
+        for (auto &p : periodes)
+            calculate(monitor, counters, p);
+    }
+    // the same for a single channel that starts its own period
+    void calculate(UsbMon &monitor, CounterSource &counters, ChannelPeriode &p) noexcept {
+        if (counters.is_counter_channel(p.channel))
+            p.bytes = counters.get_channel_bytes(p.channel);
+        else if (cfg.drop_compensation)
+            p.bytes = monitor.get_channel_bytes(p.channel) * monitor.get_drop_scale() / UsbMon::drop_scale_one;
+        else
+            p.bytes = monitor.get_channel_bytes(p.channel);
+        p.estimate = estimators[p.channel].update(p.bytes);
+#ifdef USB_LED_FIXED
+        tie(p.high, p.low) = fixed_duty_table_t::lookup(p.estimate);
+#else
+        if (!tables.empty()) {
+            tie(p.high, p.low) = tables[p.channel].lookup(p.estimate);
+            return;
+        }
+        auto const &ch     = cfg.channels[p.channel];
+        auto [low, high]   = ranges[p.channel].update(ch, p.estimate);
+        tie(p.high, p.low) = cfg.calculate_durations(p.estimate, low, high, *ch.pwm_periode);
+#endif
+    }
+};
+
+// double buffered config of the pwm thread. the control thread writes the back buffer and publishes it,
+// the pwm thread swaps between two periods once it dropped every reference to the front buffer.
+// the hot path only pays an acquire load per period, there are no locks. a stop request ends the pwm loop
+// the same way between two periods
+class ConfigSwap {
+    Config       buffers[2];
+    atomic<int>  front{ 0 };
+    atomic<bool> published{ false };
+    atomic<bool> stopping{ false };
+    int          stop_fd = -1;     // readable once a stop was requested, ends an idle sleep
+public:
+    ConfigSwap(Config const &cfg) : buffers{ cfg, cfg } {
+        stop_fd = eventfd(0, EFD_NONBLOCK);
+        if (stop_fd == -1) {
+            cerr << "Cannot create stop eventfd!\n";
+            exit(-1);
+        }
+    }
+    ~ConfigSwap() {
+        close(stop_fd);
+    }
+    ConfigSwap(ConfigSwap const &) = delete;
+    ConfigSwap &operator=(ConfigSwap const &) = delete;
+
+    // pwm thread: the config of the running periods
+    Config const &current() const noexcept {
+        return buffers[front.load(memory_order_relaxed)];
+    }
+    // pwm thread: true if a new config waits for the swap or a stop was requested
+    bool pending() const noexcept {
+        return published.load(memory_order_acquire) || stopping.load(memory_order_relaxed);
+    }
+    // pwm thread: true once the loop should end
+    bool stopped() const noexcept {
+        return stopping.load(memory_order_relaxed);
+    }
+    int get_stop_fd() const noexcept {
+        return stop_fd;
+    }
+    // pwm thread: make a published config current, no reference to the old one may be held
+    void swap() noexcept {
+        if (!published.load(memory_order_acquire))
+            return;
+        front.store(1 - front.load(memory_order_relaxed), memory_order_relaxed);
+        published.store(false, memory_order_release);
+    }
+    // control thread: publish a config, false while the previous one is not swapped in yet
+    bool publish(Config const &cfg) {
+        if (published.load(memory_order_acquire))
+            return false;
+        buffers[1 - front.load(memory_order_relaxed)] = cfg;
+        published.store(true, memory_order_release);
+        return true;
+    }
+    // any thread: end the pwm loop, e.g. on SIGTERM
+    void request_stop() noexcept {
+        stopping.store(true, memory_order_relaxed);
+        uint64_t one = 1;
+        (void)!write(stop_fd, &one, sizeof(one));
+    }
+};
+
+// counts the periods without traffic, after cfg.idle_periods of them the pwm thread sleeps until the next traffic
+class IdleMode {
+    Config const &cfg;
+    uint32_t      quiet = 0;
+public:
+    IdleMode(Config const &c) : cfg{ c } {}
+
+    // true if the channels of the period saw no traffic and the output should sleep
+    bool update(std::vector<ChannelPeriode> const &periodes) noexcept {
+        if (cfg.idle_periods == 0)
+            return false;
+        bool traffic = any_of(periodes.begin(), periodes.end(), [](auto const &p) { return p.bytes != 0; });
+        quiet = traffic ? 0 : quiet + 1;
+        return quiet >= cfg.idle_periods;
+    }
+    // sleep with the leds off until the next traffic, returns the new grid origin
+    timepoint_t sleep(UsbMon &monitor, ConfigSwap const &configs, Scheduler &scheduler, timepoint_t until) noexcept {
+        quiet = 0;
+        // the control socket signals every published config, a signal left from a period while awake would
+        // end the sleep at once. a config published after the drain is seen by pending() or keeps the fd readable
+        uint64_t stale;
+        (void)!read(monitor.get_wake_fd(), &stale, sizeof(stale));
+        if (configs.pending() || !monitor.arm_wake())
+            return now();
+        return scheduler.sleep_until_wake(monitor.get_wake_fd(), configs.get_stop_fd(), until, cfg.pwm_periode);
+    }
+};
+
+// min-heap of the next edge of every channel, the edges of all channels are merged onto the one timer of
+// the scheduler. every channel has exactly one pending edge, so the heap never grows above the number of
+// channels and never allocates after the setup
+class EdgeQueue {
+public:
+    struct Edge {
+        timepoint_t deadline;
+        uint32_t    channel;
+        bool        rising;
+        uint32_t    pulse = 0;  // pulse of the period, only the rising edge of pulse 0 starts a period
+    };
+private:
+    std::vector<Edge> heap;
+
+    static bool later(Edge const &a, Edge const &b) noexcept {
+        return a.deadline > b.deadline;
+    }
+public:
+    EdgeQueue(size_t channels) {
+        heap.reserve(channels);
+    }
+    void push(Edge const &edge) noexcept {
+        heap.push_back(edge);
+        push_heap(heap.begin(), heap.end(), later);
+    }
+    Edge pop() noexcept {
+        pop_heap(heap.begin(), heap.end(), later);
+        auto edge = heap.back();
+        heap.pop_back();
+        return edge;
+    }
+    Edge const &top() const noexcept {
+        return heap.front();
+    }
+    void clear() noexcept {
+        heap.clear();
+    }
+};
+
+// automatically generate pwm time based on the sample interval and the maximum transfer rate. every channel
+// runs on its own period grid, all edges that are due at a wakeup are switched by a single write of the output.
+// with dithering the period is split into cfg.dither slots and every slot gets one pulse, the integer split
+// carries the rounding of a pulse into the next one so the on time of the period stays exact.
+// returns the grid position of the next edge when a new config is published
+template<typename Output>
+static timepoint_t generate_led_pwm(Config const &cfg, ConfigSwap const &configs, Output const &output, UsbMon &monitor, CounterSource &counters,
+                                    Scheduler &scheduler, Logger &logger, StartupLog &startup, timepoint_t grid, timepoint_t until) {
+    static_assert(is_led_sink<Output>::value, "the output has to switch the pins by write(on, off)");
+    auto const                  channels = cfg.channels.size();
+    std::vector<ChannelPeriode> periodes(channels);     // durations of the running period
+    std::vector<ChannelPeriode> measured(channels);     // measured durations of the last finished period, for the log
+    std::vector<timepoint_t>    starts(channels);       // grid positions of the running periods
+    std::vector<duration_t>     highs(channels);        // measured high time of the running period
+    std::vector<timepoint_t>    rises(channels);        // switch on of the running pulse
+    std::vector<uint32_t>       masks(channels);
+    auto const                  pulses = cfg.dither;
+    PeriodeCalculator           calculator{ cfg };
+    IdleMode                    idle{ cfg };
+    EdgeQueue                   edges{ channels };
+    uint32_t                    all_pins = 0;
+    for (size_t i = 0; i < channels; ++i) {
+        periodes[i].channel = measured[i].channel = i;
+        masks[i]  = Config::pin_mask(cfg.channels[i]);
+        all_pins |= masks[i];
+    }
+    // all channels start a period at the origin
+    auto restart = [&](timepoint_t origin) {
+        edges.clear();
+        for (size_t i = 0; i < channels; ++i) {
+            starts[i] = origin;
+            edges.push({ origin, static_cast<uint32_t>(i), true });
+        }
+    };
+    // the on time of a pulse, the pulses of a period sum up to its high time
+    auto pulse_high = [pulses](duration_t high, uint32_t pulse) {
+        return high * (pulse + 1) / pulses - high * pulse / pulses;
+    };
+    // the rising edge after a pulse, the next slot of the period or the start of the next period
+    auto next_pulse = [&](uint32_t c, uint32_t pulse) -> EdgeQueue::Edge {
+        auto periode = *cfg.channels[c].pwm_periode;
+        if (pulse + 1 < pulses)
+            return { starts[c] + periode * (pulse + 1) / pulses, c, true, pulse + 1 };
+        return { starts[c] + periode, c, true, 0 };
+    };
+    restart(grid);
+    timepoint_t last_tsc = grid;
+
+    scheduler.setup_done();
+    while (edges.top().deadline < until && !configs.pending()) {
+        scheduler.wait_until(edges.top().deadline);
+        auto     tsc  = now();
+        uint32_t on   = 0, off = 0, fell = 0;
+        bool     tick = false;      // channel 0 started a period, the log and the idle check follow its period
+        bool     finished = false;  // and it finished one before, the measured values are valid
+        // take every edge that is due, edges sharing a deadline are always taken together
+        while (edges.top().deadline <= tsc) {
+            auto  edge    = edges.pop();
+            auto  c       = edge.channel;
+            auto &p       = periodes[c];
+            if (!edge.rising) {
+                off  |= masks[c];
+                fell |= 1u << c;
+                edges.push(next_pulse(c, edge.pulse));
+                continue;
+            }
+            if (edge.pulse == 0) {
+                // the first rising edge after a restart does not finish a period
+                bool finishes = edge.deadline != starts[c];
+                if (finishes)
+                    measured[c] = { c, p.bytes, p.estimate, highs[c], chrono::duration_cast<duration_t>(tsc - starts[c]) - highs[c] };
+                if (c == 0) {
+                    tick     = true;
+                    finished = finishes;
+                }
+                starts[c] = edge.deadline;
+                highs[c]  = 0ms;
+                calculator.calculate(monitor, counters, p);
+            }
+            if (auto high = pulse_high(p.high, edge.pulse); high > 0ms) {
+                on |= masks[c];
+                rises[c] = edge.deadline;
+                edges.push({ edge.deadline + high, c, false, edge.pulse });
+            } else {
+                edges.push(next_pulse(c, edge.pulse));
+            }
+        }
+        // a channel that is switched on again at its falling edge (no off time) stays on
+        output.write(on, off & ~on);
+        auto written = now();
+        startup.edge_written();
+        for (auto mask = fell; mask != 0; mask &= mask - 1) {
+            auto c    = __builtin_ctz(mask);
+            highs[c] += chrono::duration_cast<duration_t>(written - rises[c]);
+        }
+        if (!tick)
+            continue;
+
+        if (idle.update(periodes)) {
+            output.write(0, all_pins);
+            last_tsc = idle.sleep(monitor, configs, scheduler, until);
+            restart(last_tsc);
+            continue;
+        }
+        if (cfg.logging && finished)
+            log_periode(logger, cfg, monitor, measured, chrono::duration_cast<duration_t>(tsc - last_tsc), tsc - starts[0]);
+        last_tsc = tsc;
+    }
+    return edges.top().deadline;
+}
+
+// update the duty of the hardware pwm once per period, no wakeup for the single edges
+static timepoint_t generate_hardware_pwm(Config const &cfg, ConfigSwap const &configs, HardwarePwm &pwm, UsbMon &monitor, CounterSource &counters,
+                                         Scheduler &scheduler, Logger &logger, StartupLog &startup, timepoint_t grid, timepoint_t until) {
+    timepoint_t last_tsc = grid;
+    std::vector<ChannelPeriode> periodes(cfg.channels.size());
+    PeriodeCalculator           calculator{ cfg };
+    IdleMode                    idle{ cfg };
+    for (size_t i = 0; i < periodes.size(); ++i)
+        periodes[i].channel = i;
+    // with dithering the hardware runs the pulses of a period by itself, the sampling period costs no extra wakeups
+    pwm.set_periode(cfg.pwm_periode / cfg.dither);
+
+    scheduler.setup_done();
+    while (grid < until && !configs.pending()) {
+        auto tsc = now();
+        calculator.calculate(monitor, counters, periodes);
+        if (idle.update(periodes)) {
+            for (auto const &p : periodes)
+                pwm.set_duty(p.channel, 0ms);
+            grid = last_tsc = idle.sleep(monitor, configs, scheduler, until);
+            continue;
+        }
+        for (auto const &p : periodes)
+            pwm.set_duty(p.channel, p.high / cfg.dither);
+        startup.edge_written();
+        scheduler.wait_until(grid + cfg.pwm_periode);
+
+        if (cfg.logging)
+            log_periode(logger, cfg, monitor, periodes, chrono::duration_cast<duration_t>(tsc - last_tsc), tsc - grid);
+        last_tsc = tsc;
+        grid    += cfg.pwm_periode;
+    }
+    return grid;
+}
+
+// run a pwm generator and restart it between two periods with every config published by the control socket
+template<typename Generate>
+static void run_live(ConfigSwap &configs, timepoint_t until, Generate &&generate) {
+    for (auto grid = now(); grid < until && !configs.stopped(); grid = generate(configs.current(), grid))
+        configs.swap();
+}
+
+void print_help() {
+    puts(
+        "-help                 ... print this message\n" \
+        "-logging              ... enable logging\n" \
+        "-period value         ... pwm period [s,ms,us]\n" \
+        "-off value[%]         ... enforced off period of the led in percent\n" \
+        "-max value[Mbps,kbps] ... maximum usb transfer rate\n" \
+        "-min value[Mbps,kbps] ... minimum usb transfer rate\n" \
+        "-pin value            ... pin to use\n" \
+        "-bus value            ... usb bus to capture, 0 captures all buses\n" \
+        "-map filter:output    ... drive pins by a subset of the events, e.g. bus=2,dev=5,dir=in,type=bulk:pin=17,max=1Mbps\n" \
+        "                          or by the counters of a network interface or block device, e.g. net=eth0,dir=out:pin=18\n" \
+        "                          or by a mapping of a publishing host, e.g. remote=10.0.0.5,channel=1:pin=19\n" \
+        "-inv                  ... invert the HIGH and LOW state\n" \
+        "-ewma value[s,ms]     ... smooth the rate by an exponentially weighted average with the given half-life\n" \
+        "-window value[s,ms]   ... smooth the rate by a sliding window of the given length\n" \
+        "-scale linear|log     ... map the rate linear or logarithmic to the duty cycle\n" \
+        "-autorange value      ... rescale to the rolling range of the rate, relaxing by the half-life [s,ms]\n" \
+        "-lut value            ... map the rate through a duty table with the given number of levels (2-65536)\n" \
+        "-gamma value          ... gamma of the brightness, e.g. 2.2\n" \
+        "-dither value         ... spread the on time of a period over the given number of pulses\n" \
+        "-idle value           ... sleep without wakeups after the given number of periods without traffic\n" \
+        "-ring_size value      ... resize the kernel ring of every usbmon device [kB,MB]\n" \
+        "-drop_compensation    ... scale the usb rates by the events usbmon dropped\n" \
+        "-top value            ... number of devices in the top talkers view of the statistics and the log, 0 disables it\n" \
+        "-capture_cpu value    ... pin the usb capture thread to a cpu\n" \
+        "-busypoll             ... spin the capture thread on its cpu instead of waiting for events (needs -capture_cpu)\n" \
+        "-pwm_cpu value        ... pin the pwm thread to a cpu\n" \
+        "-rt value             ... run the pwm thread at the given SCHED_FIFO priority (2-99) with locked memory\n" \
+        "-hwpwm                ... use the hardware pwm of the pins (BCM 12, 13, 18, 19)\n" \
+        "-pwmchip value        ... sysfs pwm chip of the hardware pwm\n" \
+        "-gpiomem              ... switch the pins by the gpio registers of /dev/gpiomem\n" \
+        "-gpiod                ... switch the pins by the gpio character device (libgpiod build)\n" \
+        "-gpiochip name        ... gpio chip of the gpiod output\n" \
+        "-null                 ... discard the edges and only count them (default without wiringPi and libgpiod)\n" \
+        "-bench value          ... benchmark with replayed events at the given events/s, 0 as fast as possible\n" \
+        "-bench_time value     ... duration of the benchmark [s,ms]\n" \
+        "-bench_file path      ... replay a trace of -record or a file of binary usbmon headers instead of generated events\n" \
+        "-record path          ... write every captured event to a trace file\n" \
+        "-stats path           ... serve the statistics on a unix socket (always printed on SIGUSR1)\n" \
+        "-config path          ... read flags from a file, one key=value per line (e.g. max=2Mbps)\n" \
+        "-publish address:port ... send the rates of the usb mappings to a consuming host every period (udp)\n" \
+        "-subscribe port       ... receive the rates of publishing hosts for the remote mappings\n" \
+        "-control path         ... change -period, -max, -min, -off, -idle, -ewma, -window, -scale, -autorange, -lut, -gamma\n" \
+        "                          while running by lines sent to a unix socket"
+    );
+}
+
+[[noreturn]] void unknown_argument_kill(string_view const &v) {
+    cout << "Unknown or invalid argument: " << v << endl;
+    print_help();
+    exit(-1);
+}
+
+// parse a value with an optional unit, nothing if the value or the unit is invalid
+template<typename T, typename V = uint64_t>
+optional<T> try_parse_value(string_view const &v, map<string_view, V> const &extentions) noexcept {
+    int value = 0;
+    auto [p, ec] = from_chars(v.data(), v.data() + v.size(), value);
+    if (ec != errc{}) {
+        return {};
+    }
+    string_view extention{ p, static_cast<size_t>(v.data() + v.size() - p) };
+    if (extentions.empty()) {
+        return extention.empty() ? optional<T>{ T(value) } : optional<T>{};
+    }
+    auto multiplier = extentions.find(extention);
+    if (multiplier == extentions.end()) {
+        return {};
+    }
+    return T(value * multiplier->second);
+}
+
+template<typename T, typename V = uint64_t>
+T parse_value(string_view const &v, map<string_view, V> const &extentions) {
+    auto value = try_parse_value<T>(v, extentions);
+    if (!value) {
+        unknown_argument_kill(v);
+    }
+    return *value;
+}
+
+// call f for every "key=value" pair of a comma separated list
+template<typename F>
+void parse_key_values(string_view list, F &&f) {
+    while (!list.empty()) {
+        auto item  = list.substr(0, list.find(','));
+        auto equal = item.find('=');
+        if (equal == string_view::npos)
+            unknown_argument_kill(item);
+        f(item.substr(0, equal), item.substr(equal + 1));
+        list.remove_prefix(min(item.size() + 1, list.size()));
+    }
+}
+
+// parse a BCM pin, the outputs address the pins of the first gpio bank by bitmasks
+int parse_pin(string_view const &v) {
+    auto pin = parse_value<int>(v, {});
+    if (pin < 0 || pin > 31)
+        unknown_argument_kill(v);
+    return pin;
+}
+
+Channel parse_channel(string_view const &v);
+void parse_config_file(Config &cfg, string_view const &path);
+
+// parse a '+' separated list of transfer types, e.g. "bulk+int"
+uint8_t parse_types(string_view list) {
+    uint8_t types = 0;
+    while (!list.empty()) {
+        auto type = list.substr(0, list.find('+'));
+        if (type == "iso"sv)
+            types |= 1u << Channel::Iso;
+        else if (type == "int"sv)
+            types |= 1u << Channel::Interrupt;
+        else if (type == "ctrl"sv)
+            types |= 1u << Channel::Control;
+        else if (type == "bulk"sv)
+            types |= 1u << Channel::Bulk;
+        else
+            unknown_argument_kill(type);
+        list.remove_prefix(min(type.size() + 1, list.size()));
+    }
+    return types;
+}
+
+// gamma exponent of the duty cycle, e.g. "2.2", nothing if invalid
+optional<double> try_parse_gamma(string_view const &v) noexcept {
+    double gamma = 0.0;
+    auto [p, ec] = from_chars(v.data(), v.data() + v.size(), gamma);
+    if (ec != errc{} || p != v.data() + v.size() || gamma < 0.1 || gamma > 5.0)
+        return {};
+    return gamma;
+}
+
+double parse_gamma(string_view const &v) {
+    auto gamma = try_parse_gamma(v);
+    if (!gamma)
+        unknown_argument_kill(v);
+    return *gamma;
+}
+
+// levels of the duty table, 0 disables it, nothing if invalid
+optional<size_t> try_parse_levels(string_view const &v) noexcept {
+    auto levels = try_parse_value<int64_t>(v, {});
+    if (!levels || (*levels != 0 && (*levels < 2 || *levels > 65536)))
+        return {};
+    return static_cast<size_t>(*levels);
+}
+
+size_t parse_levels(string_view const &v) {
+    auto levels = try_parse_levels(v);
+    if (!levels)
+        unknown_argument_kill(v);
+    return *levels;
+}
+
+// pulses per period of the dithering
+uint32_t parse_dither(string_view const &v) {
+    auto pulses = parse_value<uint32_t>(v, {});
+    if (pulses < 1 || pulses > 64)
+        unknown_argument_kill(v);
+    return pulses;
+}
+
+// SCHED_FIFO priority, the capture thread runs one below the pwm thread
+int parse_rt_priority(string_view const &v) {
+    auto priority = parse_value<int>(v, {});
+    if (priority < 2 || priority > 99)
+        unknown_argument_kill(v);
+    return priority;
+}
+
+Config::Scale parse_scale(string_view const &v) {
+    if (v == "linear"sv)
+        return Config::Scale::Linear;
+    if (v == "log"sv)
+        return Config::Scale::Log;
+    unknown_argument_kill(v);
+}
+
+auto const size_extentions    = map<string_view, uint64_t> {{ "Mbps"sv, 1024*1024 }, { "kbps"sv, 1024 }};
+auto const time_extentions    = map<string_view, uint64_t> {{ "s"sv, 1000000 }, { "ms"sv, 1000 }, { "us"sv, 1 }};
+auto const percent_extentions = map<string_view, double>   {{ "%"sv, 1.0/100.0 }};
+auto const byte_extentions    = map<string_view, uint64_t> {{ "MB"sv, 1024*1024 }, { "kB"sv, 1024 }};
+
+auto const zero_argument_commands = map<string_view, void(*)(Config &)> {
+    { "-logging"sv, [](auto &cfg) { cfg.logging = true; }},
+    { "-help"sv,    [](auto &cfg) { print_help();       }},
+    { "-inv"sv,     [](auto &cfg) { cfg.invert = true;  }},
+    { "-drop_compensation"sv, [](auto &cfg) { cfg.drop_compensation = true; }},
+    { "-busypoll"sv, [](auto &cfg) { cfg.busypoll = true; }},
+    { "-hwpwm"sv,   [](auto &cfg) { cfg.output = Config::Output::HardwarePwm; }},
+    { "-gpiomem"sv, [](auto &cfg) { cfg.output = Config::Output::GpioMem;     }},
+    { "-gpiod"sv,   [](auto &cfg) { cfg.output = Config::Output::Gpiod;       }},
+    { "-null"sv,    [](auto &cfg) { cfg.output = Config::Output::Null;        }},
+};
+
+auto const one_argument_commands = map<string_view, void(*)(Config &, string_view)> {
+#ifndef USB_LED_FIXED
+    { "-period"sv, [](auto &cfg, auto value) { cfg.pwm_periode       = parse_value<duration_t>(value, time_extentions);    }},
+    { "-max"sv,    [](auto &cfg, auto value) { cfg.max_transfer_rate = parse_value<uint64_t>  (value, size_extentions);    }},
+    { "-min"sv,    [](auto &cfg, auto value) { cfg.min_transfer_rate = parse_value<uint64_t>  (value, size_extentions);    }},
+    { "-off"sv,    [](auto &cfg, auto value) { cfg.off_periode_ratio = parse_value<double>    (value, percent_extentions); }},
+#endif
+    { "-pin"sv,    [](auto &cfg, auto value) { cfg.led_pins.push_back(parse_pin(value));                                    }},
+    { "-bus"sv,    [](auto &cfg, auto value) { cfg.usb_buses.push_back(parse_value<int>      (value, {}));                 }},
+    { "-map"sv,    [](auto &cfg, auto value) { cfg.channels.push_back(parse_channel(value));                                }},
+    { "-capture_cpu"sv, [](auto &cfg, auto value) { cfg.capture_cpu = parse_value<int>(value, {}); }},
+    { "-pwm_cpu"sv,     [](auto &cfg, auto value) { cfg.pwm_cpu     = parse_value<int>(value, {}); }},
+    { "-rt"sv,          [](auto &cfg, auto value) { cfg.rt_priority = parse_rt_priority(value);    }},
+    { "-pwmchip"sv,     [](auto &cfg, auto value) { cfg.pwm_chip    = parse_value<int>(value, {}); }},
+    { "-gpiochip"sv,    [](auto &cfg, auto value) { cfg.gpio_chip   = std::string{ value };        }},
+    { "-bench"sv,       [](auto &cfg, auto value) { cfg.bench = true; cfg.bench_rate = parse_value<uint64_t>(value, {}); }},
+    { "-bench_time"sv,  [](auto &cfg, auto value) { cfg.bench_time = parse_value<duration_t>(value, time_extentions);   }},
+    { "-bench_file"sv,  [](auto &cfg, auto value) { cfg.bench_file = std::string{ value };                              }},
+    { "-record"sv,      [](auto &cfg, auto value) { cfg.record_file = std::string{ value };                             }},
+    { "-ewma"sv,        [](auto &cfg, auto value) { cfg.estimate = Config::Estimate::Ewma;   cfg.estimate_time = parse_value<duration_t>(value, time_extentions); }},
+    { "-window"sv,      [](auto &cfg, auto value) { cfg.estimate = Config::Estimate::Window; cfg.estimate_time = parse_value<duration_t>(value, time_extentions); }},
+    { "-idle"sv,        [](auto &cfg, auto value) { cfg.idle_periods = parse_value<uint32_t>(value, {});                }},
+    { "-dither"sv,      [](auto &cfg, auto value) { cfg.dither = parse_dither(value);                                   }},
+    { "-ring_size"sv,   [](auto &cfg, auto value) { cfg.ring_size = parse_value<uint32_t>(value, byte_extentions);      }},
+#ifndef USB_LED_FIXED
+    { "-scale"sv,       [](auto &cfg, auto value) { cfg.scale = parse_scale(value);                                     }},
+    { "-gamma"sv,       [](auto &cfg, auto value) { cfg.gamma = parse_gamma(value);                                     }},
+    { "-autorange"sv,   [](auto &cfg, auto value) { cfg.auto_range_time = parse_value<duration_t>(value, time_extentions); }},
+    { "-lut"sv,         [](auto &cfg, auto value) { cfg.duty_table_levels = parse_levels(value);                        }},
+#endif
+    { "-stats"sv,       [](auto &cfg, auto value) { cfg.stats_socket = std::string{ value };                            }},
+    { "-top"sv,         [](auto &cfg, auto value) { cfg.top_devices = parse_value<size_t>(value, {});                   }},
+    { "-control"sv,     [](auto &cfg, auto value) { cfg.control_socket = std::string{ value };                          }},
+    { "-publish"sv,     [](auto &cfg, auto value) { cfg.publish_target = std::string{ value };                          }},
+    { "-subscribe"sv,   [](auto &cfg, auto value) { cfg.subscribe_port = parse_value<uint16_t>(value, {});              }},
+    { "-config"sv,      [](auto &cfg, auto value) { parse_config_file(cfg, value);                                      }},
+};
+
+// parse a mapping of the form "bus=2,dev=5,dir=in,type=bulk+int:pin=17,max=1Mbps,min=1kbps"
+Channel parse_channel(string_view const &v) {
+    auto split = v.find(':');
+    if (split == string_view::npos)
+        unknown_argument_kill(v);
+
+    Channel ch{};
+    // -1 matches every bus or device and is only set by leaving the key out
+    auto parse_number = [](auto value) {
+        auto number = parse_value<int>(value, {});
+        if (number < 0)
+            unknown_argument_kill(value);
+        return number;
+    };
+    parse_key_values(v.substr(0, split), [&](auto key, auto value) {
+        if (key == "net"sv)
+            ch.net = std::string{ value };
+        else if (key == "block"sv)
+            ch.block = std::string{ value };
+        else if (key == "remote"sv)
+            ch.remote = std::string{ value };
+        else if (key == "channel"sv)
+            ch.remote_channel = parse_value<int>(value, {});
+        else if (key == "bus"sv)
+            ch.bus = parse_number(value);
+        else if (key == "dev"sv)
+            ch.device = parse_number(value);
+        else if (key == "dir"sv && value == "in"sv)
+            ch.direction = Channel::Direction::In;
+        else if (key == "dir"sv && value == "out"sv)
+            ch.direction = Channel::Direction::Out;
+        else if (key == "type"sv)
+            ch.types = parse_types(value);
+        else
+            unknown_argument_kill(key);
+    });
+    parse_key_values(v.substr(split + 1), [&](auto key, auto value) {
+        if (key == "pin"sv)
+            ch.pins.push_back(parse_pin(value));
+#ifndef USB_LED_FIXED
+        else if (key == "max"sv)
+            ch.max_transfer_rate = parse_value<uint64_t>(value, size_extentions);
+        else if (key == "min"sv)
+            ch.min_transfer_rate = parse_value<uint64_t>(value, size_extentions);
+        else if (key == "period"sv)
+            ch.pwm_periode = parse_value<duration_t>(value, time_extentions);
+#endif
+        else
+            unknown_argument_kill(key);
+    });
+    if (ch.pins.empty() || ch.device >= 128 || (ch.pwm_periode && *ch.pwm_periode <= 0ms))
+        unknown_argument_kill(v);
+    // a counter channel has no usb filters and the interface or device is a plain name below /sys
+    auto kinds = !ch.net.empty() + !ch.block.empty() + !ch.remote.empty();
+    if (ch.is_counter() && (ch.bus >= 0 || ch.device >= 0 || ch.types != Channel::all_types || kinds > 1
+                            || ch.net.find('/') != std::string::npos || ch.block.find('/') != std::string::npos))
+        unknown_argument_kill(v);
+    if (ch.remote_channel < 0 || ch.remote_channel >= static_cast<int>(Config::max_channels) || (ch.remote.empty() && ch.remote_channel != 0))
+        unknown_argument_kill(v);
+    return ch;
+}
+
+Config parse_arguments(arguments_t const &arguments) {
+    Config cfg{};
+    auto cur = arguments.cbegin();
+    auto const end = arguments.cend();
+
+    while (cur != end) {
+        auto const argument = *cur++;
+        if (auto cmd = zero_argument_commands.find(argument); cmd != zero_argument_commands.end())
+            cmd->second(cfg);
+        else if (auto cmd = one_argument_commands.find(argument); cmd != one_argument_commands.end() && cur != end)
+            cmd->second(cfg, *cur++);
+        else
+            unknown_argument_kill(argument);
+    }
+    return cfg;   
+}
+
+// apply a config file in a single pass, one "key=value" per line with the flag name as the key, e.g.
+// "max=2Mbps", "map=bus=1:pin=18" or "logging" for flags without a value. empty lines and lines
+// starting with '#' are skipped, later flags on the command line override the file
+void parse_config_file(Config &cfg, string_view const &path) {
+    std::string file{ path };
+    int fd = open(file.c_str(), O_RDONLY);
+    struct stat info{};
+    if (fd == -1 || fstat(fd, &info) == -1) {
+        cerr << "Cannot open config file " << file << "!\n";
+        exit(-1);
+    }
+    std::string text(info.st_size, '\0');
+    auto length = read(fd, text.data(), text.size());
+    close(fd);
+
+    string_view rest{ text.data(), static_cast<size_t>(max<ssize_t>(length, 0)) };
+    std::string flag;
+    while (!rest.empty()) {
+        auto line = rest.substr(0, rest.find('\n'));
+        rest.remove_prefix(min(line.size() + 1, rest.size()));
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' '))
+            line.remove_suffix(1);
+        if (line.empty() || line.front() == '#')
+            continue;
+        auto equal = line.find('=');
+        flag.assign("-").append(line.substr(0, equal));
+        if (equal == string_view::npos) {
+            auto cmd = zero_argument_commands.find(flag);
+            if (cmd == zero_argument_commands.end())
+                unknown_argument_kill(line);
+            cmd->second(cfg);
+        } else {
+            auto cmd = one_argument_commands.find(flag);
+            if (cmd == one_argument_commands.end())
+                unknown_argument_kill(line);
+            cmd->second(cfg, line.substr(equal + 1));
+        }
+    }
+}
+
+// assign a parsed value, false if it was invalid
+template<typename T, typename U>
+static bool assign(T &target, optional<U> const &value) noexcept {
+    if (value)
+        target = T(*value);
+    return value.has_value();
+}
+
+// the settings that can be changed while running, they only affect the rate to duty mapping of the pwm thread
+auto const live_commands = map<string_view, bool(*)(Config &, string_view)> {
+#ifndef USB_LED_FIXED
+    { "-period"sv,    [](auto &cfg, auto value) { return assign(cfg.pwm_periode,       try_parse_value<duration_t>(value, time_extentions));    }},
+    { "-max"sv,       [](auto &cfg, auto value) { return assign(cfg.max_transfer_rate, try_parse_value<uint64_t>  (value, size_extentions));    }},
+    { "-min"sv,       [](auto &cfg, auto value) { return assign(cfg.min_transfer_rate, try_parse_value<uint64_t>  (value, size_extentions));    }},
+    { "-off"sv,       [](auto &cfg, auto value) { return assign(cfg.off_periode_ratio, try_parse_value<double>    (value, percent_extentions)); }},
+    { "-autorange"sv, [](auto &cfg, auto value) { return assign(cfg.auto_range_time,   try_parse_value<duration_t>(value, time_extentions));    }},
+    { "-lut"sv,       [](auto &cfg, auto value) { return assign(cfg.duty_table_levels, try_parse_levels(value));                                }},
+    { "-gamma"sv,     [](auto &cfg, auto value) { return assign(cfg.gamma,             try_parse_gamma(value));                                 }},
+    { "-scale"sv,     [](auto &cfg, auto value) { 
+        if (value != "linear"sv && value != "log"sv)
+            return false;
+        cfg.scale = value == "log"sv ? Config::Scale::Log : Config::Scale::Linear;
+        return true;
+    }},
+#endif
+    { "-idle"sv,      [](auto &cfg, auto value) { return assign(cfg.idle_periods,      try_parse_value<uint32_t>  (value, {}));                 }},
+    { "-ewma"sv,      [](auto &cfg, auto value) { cfg.estimate = Config::Estimate::Ewma;   return assign(cfg.estimate_time, try_parse_value<duration_t>(value, time_extentions)); }},
+    { "-window"sv,    [](auto &cfg, auto value) { cfg.estimate = Config::Estimate::Window; return assign(cfg.estimate_time, try_parse_value<duration_t>(value, time_extentions)); }},
+};
+
+// the checks of the settings that can change while running, shared by the startup and the control socket.
+// returns the reason a config is rejected
+optional<string_view> check_settings(Config const &cfg) noexcept {
+    // the sliding window keeps one bucket per period of the fastest channel
+    constexpr int64_t max_window_periodes = 65536;
+    if (cfg.pwm_periode <= 0ms || cfg.max_transfer_rate <= cfg.min_transfer_rate)
+        return "The period has to be positive and the maximum rate above the minimum rate"sv;
+    if (cfg.off_periode_ratio < 0.0 || cfg.off_periode_ratio > 1.0)
+        return "The off period has to be within 0% and 100%"sv;
+    if (cfg.estimate_time < 0ms || cfg.auto_range_time < 0ms)
+        return "The estimate and the auto range time can not be negative"sv;
+    auto shortest = cfg.pwm_periode;
+    for (auto const &ch : cfg.channels) {
+        if (ch.pwm_periode)
+            shortest = min(shortest, *ch.pwm_periode);
+    }
+    if (cfg.estimate == Config::Estimate::Window && cfg.estimate_time / shortest > max_window_periodes)
+        return "The sliding window can be at most 65536 periods long"sv;
+    if (cfg.duty_table_levels != 0 && cfg.auto_range_time > 0ms)
+        return "The duty table needs a fixed range, it can not be combined with the auto range"sv;
+    if (cfg.idle_periods != 0 && cfg.has_counter_channels())
+        return "The idle mode wakes up on usb traffic only, it can not be combined with net, block or remote mappings"sv;
+    return {};
+}
+
+// apply "-flag value" pairs of the live commands to the config, returns the first invalid argument
+optional<string_view> apply_live_arguments(Config &cfg, arguments_t const &arguments) {
+    for (auto cur = arguments.cbegin(); cur != arguments.cend(); cur += 2) {
+        auto cmd = live_commands.find(*cur);
+        if (cmd == live_commands.end() || cur + 1 == arguments.cend() || !cmd->second(cfg, *(cur + 1)))
+            return *cur;
+    }
+    return check_settings(cfg);
+}
+
+// listen on a unix stream socket, replaces a stale socket file, -1 on failure
+static int listen_unix(std::string const &socket_path) noexcept {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path))
+        return -1;
+    strcpy(address.sun_path, socket_path.c_str());
+    unlink(socket_path.c_str());
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 
+        || bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == -1 
+        || listen(fd, 4) == -1) {
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void write_all(int fd, std::string const &text) noexcept {
+    for (size_t done = 0; done < text.size();) {
+        auto written = write(fd, text.data() + done, text.size() - done);
+        if (written <= 0)
+            return;
+        done += written;
+    }
+}
+
+// serves the statistics on SIGUSR1 (to stderr) and to every client connecting to the unix socket,
+// the requests are handled on its own thread so the hot paths never format or write them
+class StatsServer {
+    static constexpr uint32_t signal_tag = 0;
+    static constexpr uint32_t listen_tag = 1;
+    static constexpr uint32_t stop_tag   = 2;
+
+    Stats const &stats;
+    ConfigSwap  &configs;
+    std::string  path;
+    int          epoll_fd  = -1;
+    int          signal_fd = -1;
+    int          listen_fd = -1;
+    int          stop_fd   = -1;
+    std::thread  server;
+public:
+    // must be created before any other thread, the signals are only received through the signalfd. SIGINT
+    // and SIGTERM stop the pwm loop, so every thread is joined and the trace is written to the end
+    StatsServer(Stats const &s, ConfigSwap &c, std::string const &socket_path) : stats{ s }, configs{ c }, path{ socket_path } {
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGUSR1);
+        sigaddset(&mask, SIGINT);
+        sigaddset(&mask, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
+        epoll_fd  = epoll_create1(0);
+        signal_fd = signalfd(-1, &mask, 0);
+        stop_fd   = eventfd(0, 0);
+        if (epoll_fd == -1 || signal_fd == -1 || stop_fd == -1) {
+            cerr << "Cannot create statistics server!\n";
+            exit(-1);
+        }
+        watch(signal_fd, signal_tag);
+        watch(stop_fd, stop_tag);
+        if (!path.empty())
+            listen_on(path);
+        server = std::thread{ [this] { run(); } };
+    }
+    ~StatsServer() {
+        uint64_t one = 1;
+        (void)!write(stop_fd, &one, sizeof(one));
+        server.join();
+        if (listen_fd != -1) {
+            close(listen_fd);
+            unlink(path.c_str());
+        }
+        close(stop_fd);
+        close(signal_fd);
+        close(epoll_fd);
+    }
+    StatsServer(StatsServer const &) = delete;
+    StatsServer &operator=(StatsServer const &) = delete;
+private:
+    void watch(int fd, uint32_t tag) {
+        epoll_event event{};
+        event.events   = EPOLLIN;
+        event.data.u32 = tag;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+            cerr << "Cannot watch file descriptor " << fd << "!\n";
+            exit(-1);
+        }
+    }
+
+    void listen_on(std::string const &socket_path) {
+        listen_fd = listen_unix(socket_path);
+        if (listen_fd == -1) {
+            cerr << "Cannot listen on statistics socket " << socket_path << "!\n";
+            exit(-1);
+        }
+        watch(listen_fd, listen_tag);
+    }
+
+    void run() {
+        for (;;) {
+            epoll_event event;
+            if (epoll_wait(epoll_fd, &event, 1, -1) != 1)
+                continue;
+            switch (event.data.u32) {
+                case signal_tag: {
+                    signalfd_siginfo info;
+                    if (read(signal_fd, &info, sizeof(info)) != sizeof(info))
+                        break;
+                    if (info.ssi_signo == SIGUSR1)
+                        write_all(STDERR_FILENO, stats.report());
+                    else
+                        configs.request_stop();
+                    break;
+                }
+                case listen_tag: {
+                    int client = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+                    if (client != -1) {
+                        write_all(client, stats.report());
+                        close(client);
+                    }
+                    break;
+                }
+                default:
+                    return;
+            }
+        }
+    }
+};
+
+// applies live settings sent to the control socket, one line of "-flag value" pairs per connection,
+// e.g. "echo -max 2Mbps -period 50ms | socat - UNIX-CONNECT:path". the changes are cumulative and
+// swapped in between two periods of the pwm thread, the capture and the outputs keep running
+class ControlServer {
+    static constexpr uint32_t listen_tag = 0;
+    static constexpr uint32_t stop_tag   = 1;
+
+    ConfigSwap &configs;
+    Config      source;     // the settings as given, before resolve_channels() and calculate_periode_values()
+    std::string path;
+    int         wake_fd;
+    int         epoll_fd  = -1;
+    int         listen_fd = -1;
+    int         stop_fd   = -1;
+    std::thread server;
+public:
+    // source is the parsed config with the defaults applied, the wake fd ends an idle sleep of the pwm thread
+    ControlServer(ConfigSwap &c, Config const &src, int wake) : configs{ c }, source{ src }, path{ src.control_socket }, wake_fd{ wake } {
+        epoll_fd  = epoll_create1(0);
+        stop_fd   = eventfd(0, 0);
+        listen_fd = listen_unix(path);
+        epoll_event event{};
+        event.events   = EPOLLIN;
+        event.data.u32 = listen_tag;
+        if (epoll_fd == -1 || stop_fd == -1 || listen_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) == -1) {
+            cerr << "Cannot listen on control socket " << path << "!\n";
+            exit(-1);
+        }
+        event.data.u32 = stop_tag;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &event);
+        server = std::thread{ [this] { run(); } };
+    }
+    ~ControlServer() {
+        uint64_t one = 1;
+        (void)!write(stop_fd, &one, sizeof(one));
+        server.join();
+        close(listen_fd);
+        unlink(path.c_str());
+        close(stop_fd);
+        close(epoll_fd);
+    }
+    ControlServer(ControlServer const &) = delete;
+    ControlServer &operator=(ControlServer const &) = delete;
+private:
+    // read one request line, the client has a second to send it
+    static std::string read_request(int client) noexcept {
+        timeval timeout{ 1, 0 };
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        std::string request;
+        char buffer[256];
+        while (request.find('\n') == std::string::npos && request.size() < 4096) {
+            auto received = read(client, buffer, sizeof(buffer));
+            if (received <= 0)
+                break;
+            request.append(buffer, received);
+        }
+        return request.substr(0, request.find('\n'));
+    }
+
+    static arguments_t split(string_view line) {
+        arguments_t arguments;
+        while (!line.empty()) {
+            auto start = line.find_first_not_of(" \t\r");
+            if (start == string_view::npos)
+                break;
+            line.remove_prefix(start);
+            auto word = line.substr(0, line.find_first_of(" \t\r"));
+            arguments.push_back(word);
+            line.remove_prefix(word.size());
+        }
+        return arguments;
+    }
+
+    // apply a request, the answer is "ok" or the reason it was rejected
+    std::string apply(std::string const &request) {
+        Config next = source;
+        if (auto invalid = apply_live_arguments(next, split(request)))
+            return "error: " + std::string{ *invalid } + "\n";
+        Config resolved = next;
+        resolved.resolve_channels();
+        resolved.calculate_periode_values();
+        // the pwm thread swaps within a period, unless it sleeps idle
+        auto deadline = now() + 1s;
+        while (!configs.publish(resolved)) {
+            if (now() > deadline)
+                return "error: busy\n";
+            this_thread::sleep_for(1ms);
+        }
+        uint64_t one = 1;
+        (void)!write(wake_fd, &one, sizeof(one));
+        source = next;
+        return "ok\n";
+    }
+
+    void run() {
+        for (;;) {
+            epoll_event event;
+            if (epoll_wait(epoll_fd, &event, 1, -1) != 1)
+                continue;
+            if (event.data.u32 == stop_tag)
+                return;
+            int client = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client != -1) {
+                write_all(client, apply(read_request(client)));
+                close(client);
+            }
+        }
+    }
+};
+
+// timepoints of the startup in the main thread, logged once with the first edge
+struct Startup {
+    timepoint_t main   = now();
+    timepoint_t parsed = main;
+    timepoint_t usbmon = main;
+};
+
+// sets up the configured output on its own thread, so the pin setup (e.g. wiringPiSetupGpio) overlaps
+// with opening the usbmon devices. the output is only used after wait()
+class OutputSetup {
+    optional<Raspi>       raspi;
+    optional<GpioMem>     gpio;
+    optional<HardwarePwm> pwm;
+#ifdef USING_LIBGPIOD
+    optional<Gpiod>       gpiod;
+#endif
+    optional<NullSink>    null;
+    std::thread           setup;
+    chrono::nanoseconds   setup_time{ 0 };
+    chrono::nanoseconds   wait_time{ 0 };
+public:
+    // the config has to outlive the setup
+    OutputSetup(Config const &cfg, Stats &stats) {
+        setup = std::thread{ [this, &cfg, &stats] {
+            auto start = now();
+            switch (cfg.output) {
+                case Config::Output::HardwarePwm: pwm.emplace(cfg.channels, cfg.invert, cfg.pwm_periode / cfg.dither, cfg.pwm_chip); break;
+                case Config::Output::GpioMem:     gpio.emplace(cfg.used_pins(), cfg.invert);                              break;
+#ifdef USING_LIBGPIOD
+                case Config::Output::Gpiod:       gpiod.emplace(cfg.used_pins(), cfg.invert, cfg.gpio_chip);              break;
+#endif
+                case Config::Output::Null:        null.emplace(stats);                                                     break;
+                default:                          raspi.emplace(cfg.used_pins(), cfg.invert);
+            }
+            setup_time = now() - start;
+        } };
+    }
+    ~OutputSetup() {
+        wait();
+    }
+    OutputSetup(OutputSetup const &) = delete;
+    OutputSetup &operator=(OutputSetup const &) = delete;
+
+    void wait() {
+        auto start = now();
+        if (setup.joinable())
+            setup.join();
+        wait_time += now() - start;
+    }
+    // call f with the output, valid after wait()
+    template<typename F>
+    void visit(F &&f) {
+        if (pwm)
+            f(*pwm);
+        else if (gpio)
+            f(*gpio);
+#ifdef USING_LIBGPIOD
+        else if (gpiod)
+            f(*gpiod);
+#endif
+        else if (null)
+            f(*null);
+        else
+            f(*raspi);
+    }
+    chrono::nanoseconds get_setup_time() const noexcept { return setup_time; }
+    chrono::nanoseconds get_wait_time() const noexcept { return wait_time; }
+};
+
+// the startup breakdown, every phase relative to the start of main, the first edge is filled in when it is written
+static StartupLog startup_log(Logger *logger, Startup const &startup, OutputSetup const &output) noexcept {
+    auto ns = [](auto d) { return static_cast<int64_t>(chrono::duration_cast<chrono::nanoseconds>(d).count()); };
+    return { logger, { Logger::Record::Kind::Startup, 0, 0, Logger::no_estimate, ns(startup.parsed - startup.main), ns(startup.usbmon - startup.parsed),
+                       ns(output.get_setup_time()), ns(output.get_wait_time()), 0 }, startup.main };
+}
+
+// drive the configured output until the given timepoint
+// the outputs are created once from the initial config, the pins and the output never change live
+static void run_output(ConfigSwap &configs, OutputSetup &output, UsbMon &monitor, CounterSource &counters, Scheduler &scheduler, Logger &logger,
+                       timepoint_t until, Startup const &startup) {
+    output.wait();
+    auto first_edge = startup_log(configs.current().logging ? &logger : nullptr, startup, output);
+    output.visit([&](auto &out) {
+        run_live(configs, until, [&](Config const &live, timepoint_t grid) {
+            if constexpr (is_same_v<decay_t<decltype(out)>, HardwarePwm>)
+                return generate_hardware_pwm(live, configs, out, monitor, counters, scheduler, logger, first_edge, grid, until);
+            else
+                return generate_led_pwm(live, configs, out, monitor, counters, scheduler, logger, first_edge, grid, until);
+        });
+    });
+}
+
+// replay events through the parser while the output runs and report the throughput and the edge lateness
+static void run_bench(Config const &cfg, Config const &source, ConfigSwap &configs, Stats &stats, Startup &startup) {
+    OutputSetup output{ cfg, stats };
+    Replay     replay{ cfg.bench_file };
+    UsbMon     monitor{ {}, cfg.channels, cfg.ring_size, stats };
+    CounterSource counters{ cfg.channels, cfg.subscribe_port };
+    Scheduler  scheduler{ stats };
+    optional<RatePublisher> publisher;
+    if (!cfg.publish_target.empty())
+        publisher.emplace(cfg, monitor);
+    optional<ControlServer> control;
+    if (!cfg.control_socket.empty())
+        control.emplace(configs, source, monitor.get_wake_fd());
+    startup.usbmon = now();
+
+    auto start = now();
+    monitor.start_replay(replay, cfg.bench_rate, cfg.capture_cpu, max(cfg.rt_priority - 1, 0));
+    pin_to_cpu(pthread_self(), cfg.pwm_cpu);
+    make_realtime(cfg.rt_priority);
+    {
+        Logger logger{ cfg.logging, stats };
+        run_output(configs, output, monitor, counters, scheduler, logger, start + cfg.bench_time, startup);
+    }
+    monitor.stop();
+    auto elapsed = now() - start;
+
+    auto events = monitor.get_replayed_events();
+    auto &late  = stats.lateness_ns;
+    printf(
+        "\nBenchmark: %.3f s\n\t"
+        "events: %llu (%.0f events/s)\n\t"
+        "capture cpu: %.1f ns/event\n\t"
+        "edge lateness: p50 %.1f us   p99 %.1f us   max %.1f us (%llu edges)\n",
+        to_sec(elapsed),
+        static_cast<unsigned long long>(events),
+        events / to_sec(elapsed),
+        events ? static_cast<double>(monitor.get_replay_cpu_time().count()) / events : 0.0,
+        late.quantile(0.5) / 1e3,
+        late.quantile(0.99) / 1e3,
+        late.quantile(1.0) / 1e3,
+        static_cast<unsigned long long>(late.count())
+    );
+    if (cfg.output == Config::Output::Null)
+        printf("\tnull output: %llu writes   %llu pin switches\n", static_cast<unsigned long long>(stats.null_writes.load()),
+               static_cast<unsigned long long>(stats.null_switches.load()));
+}
+
+#ifdef USB_LED_MICROBENCH
+// keep a value alive without a store the compiler could drop
+template<typename T>
+static void keep(T const &value) noexcept {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// call f with the number of items to process until the minimum time passed, returns ns per item.
+// the first run warms the caches and is not counted
+template<typename F>
+static double measure(F &&f, uint64_t items, chrono::nanoseconds minimum) {
+    f(items);
+    uint64_t done = 0;
+    auto start = now(), end = start;
+    for (; end - start < minimum; end = now()) {
+        f(items);
+        done += items;
+    }
+    return static_cast<double>(chrono::duration_cast<chrono::nanoseconds>(end - start).count()) / done;
+}
+
+// microbenchmarks of the parse, estimate, map and edge stages (make bench), the results are printed as json.
+// the first argument selects the benchmarks containing it, the second sets the time per benchmark in ms
+int run_microbench(arguments_t const &arguments) {
+    string_view filter = arguments.size() > 0 ? arguments[0] : ""sv;
+    auto minimum = chrono::milliseconds(arguments.size() > 1 ? parse_value<int>(arguments[1], {}) : 200);
+    std::vector<pair<std::string, double>> results;
+    auto run = [&](std::string name, uint64_t items, auto &&f) {
+        if (name.find(filter) != std::string::npos)
+            results.emplace_back(name, measure(f, items, minimum));
+    };
+
+    Config cfg{};
+    for (auto [bus, dir] : { pair{ 1, Channel::Direction::In }, pair{ 2, Channel::Direction::Out }, pair{ -1, Channel::Direction::Any } }) {
+        Channel ch{};
+        ch.bus       = bus;
+        ch.direction = dir;
+        ch.pins      = { 17 + static_cast<int>(cfg.channels.size()) };
+        cfg.channels.push_back(ch);
+    }
+    cfg.resolve_channels();
+    Stats  stats{};
+    Replay replay{ "" };
+    UsbMon monitor{ {}, cfg.channels, 0, stats };
+
+    // parse: the length pass and the routing of a batch of in place headers
+    for (uint32_t batch : { 1u, 16u, 64u, 256u }) {
+        run("parse/batch_" + to_string(batch), batch, [&](uint64_t count) {
+            for (uint64_t done = 0; done < count;) {
+                auto size    = static_cast<uint32_t>(min<uint64_t>({ count - done, batch, replay.contiguous(done) }));
+                auto records = replay.record(done);
+                keep(monitor.account_batch(size, [records](uint32_t i) -> mon_bin_hdr const & { return records[i]; }));
+                done += size;
+            }
+        });
+    }
+    std::vector<trace_record> traces(4096);
+    for (size_t i = 0; i < traces.size(); ++i) {
+        auto const &header = *replay.record(i);
+        traces[i] = { 0, UsbMon::event_bytes(header), static_cast<unsigned char>(header.busnum), header.devnum, header.epnum, header.xfer_type };
+    }
+    run("parse/trace_batch_256", 256, [&](uint64_t count) {
+        for (uint64_t done = 0; done < count; done += 256) {
+            auto const *records = traces.data() + done % traces.size();
+            keep(monitor.account_batch(256, [records](uint32_t i) -> trace_record const & { return records[i]; }));
+        }
+    });
+    run("parse/publish", 1, [&](uint64_t count) {
+        for (uint64_t i = 0; i < count; ++i)
+            monitor.publish_pending();
+    });
+
+    // estimate: one update per period of a channel
+    for (auto [name, mode] : { pair{ "periode", Config::Estimate::Periode }, pair{ "ewma", Config::Estimate::Ewma }, pair{ "window", Config::Estimate::Window } }) {
+        Config estimate = cfg;
+        estimate.estimate      = mode;
+        estimate.estimate_time = 1s;
+        Estimator estimator{ estimate, estimate.channels[0] };
+        run(std::string{ "estimate/" } + name, 1024, [&](uint64_t count) {
+            for (uint64_t i = 0; i < count; ++i)
+                keep(estimator.update(i * 4099 % 1048576));
+        });
+    }
+
+    // map: the rate to duty mapping of the scales, the gamma and the duty table
+    for (auto [name, scale, gamma] : { tuple{ "linear", Config::Scale::Linear, 1.0 }, tuple{ "log", Config::Scale::Log, 1.0 }, tuple{ "gamma", Config::Scale::Linear, 2.2 } }) {
+        Config map = cfg;
+        map.scale = scale;
+        map.gamma = gamma;
+        map.calculate_periode_values();
+        run(std::string{ "map/" } + name, 1024, [&](uint64_t count) {
+            for (uint64_t i = 0; i < count; ++i)
+                keep(map.calculate_durations(map.channels[0], i * 4099 % map.max_transfer_rate));
+        });
+    }
+    {
+        Config map = cfg;
+        map.calculate_periode_values();
+        DutyTable table{ map, map.channels[0], 256 };
+        run("map/duty_table", 1024, [&](uint64_t count) {
+            for (uint64_t i = 0; i < count; ++i)
+                keep(table.lookup(i * 4099 % map.max_transfer_rate));
+        });
+    }
+    run("map/parse_value", 1, [&](uint64_t count) {
+        for (uint64_t i = 0; i < count; ++i)
+            keep(try_parse_value<duration_t>("100ms"sv, time_extentions));
+    });
+
+    // edges: the next edge of 32 channels and the write of the coalesced edges
+    {
+        EdgeQueue edges{ Config::max_channels };
+        auto origin = now();
+        for (uint32_t c = 0; c < Config::max_channels; ++c)
+            edges.push({ origin + chrono::microseconds(c * 997), c, true });
+        run("edges/queue_32", 1024, [&](uint64_t count) {
+            for (uint64_t i = 0; i < count; ++i) {
+                auto edge = edges.pop();
+                edges.push({ edge.deadline + chrono::microseconds(100000 + edge.channel * 13), edge.channel, !edge.rising });
+            }
+        });
+    }
+    {
+        NullSink sink{ stats };
+        run("edges/null_write", 1024, [&](uint64_t count) {
+            for (uint64_t i = 0; i < count; ++i)
+                sink.write(static_cast<uint32_t>(i), static_cast<uint32_t>(~i));
+        });
+    }
+
+    printf("{\n  \"min_time_ms\": %lld,\n  \"benchmarks\": [", static_cast<long long>(minimum.count()));
+    for (size_t i = 0; i < results.size(); ++i)
+        printf("%s\n    { \"name\": \"%s\", \"ns_per_item\": %.3f }", i ? "," : "", results[i].first.c_str(), results[i].second);
+    printf("\n  ]\n}\n");
+    return 0;
+}
+#endif
+
+int main(int argc, char *argv[]) {
+#ifdef USB_LED_MICROBENCH
+    return run_microbench(arguments_t(argv + 1, argv + argc));
+#endif
+    Startup startup{};
+    Config  cfg = parse_arguments(arguments_t(argv + 1, argv + argc));
+    if (cfg.led_pins.empty())
+        cfg.led_pins.push_back(17); // default
+    if (cfg.usb_buses.empty() && cfg.has_usb_channels())
+        cfg.usb_buses.push_back(0); // all buses
+    Config const source = cfg;      // the live settings of the control socket apply to the unresolved config
+    cfg.resolve_channels();
+    if (cfg.channels.size() > Config::max_channels) {
+        cerr << "Too many mappings, at most " << Config::max_channels << " are supported!\n";
+        exit(-1);
+    }
+    if (auto invalid = check_settings(cfg)) {
+        cerr << *invalid << "!\n";
+        exit(-1);
+    }
+    if (cfg.output == Config::Output::HardwarePwm && cfg.has_channel_periodes()) {
+        cerr << "The hardware pwm runs all mappings with the global period, use a gpio output for periods per mapping!\n";
+        exit(-1);
+    }
+#ifndef USING_LIBGPIOD
+    if (cfg.output == Config::Output::Gpiod) {
+        cerr << "The gpiod output needs a build with libgpiod (make gpiod)!\n";
+        exit(-1);
+    }
+#endif
+    if (cfg.dither > 1 && cfg.output != Config::Output::HardwarePwm && cfg.output != Config::Output::GpioMem
+        && cfg.output != Config::Output::Null) {
+        cerr << "The dithering needs short exact pulses, use it with the hardware pwm or the gpio registers!\n";
+        exit(-1);
+    }
+    if (cfg.subscribe_port == 0 && any_of(cfg.channels.begin(), cfg.channels.end(), [](auto const &ch) { return !ch.remote.empty(); })) {
+        cerr << "The remote mappings need the udp port of the rates (-subscribe port)!\n";
+        exit(-1);
+    }
+    if (cfg.bench && !cfg.record_file.empty()) {
+        cerr << "The recording captures the usbmon devices, it can not be combined with the benchmark!\n";
+        exit(-1);
+    }
+    if (cfg.busypoll && (cfg.bench || cfg.capture_cpu < 0)) {
+        cerr << "The busy poll spins on the usbmon devices, it needs a dedicated cpu (-capture_cpu value) and no benchmark!\n";
+        exit(-1);
+    }
+    cfg.calculate_periode_values();
+    startup.parsed = now();
+
+    if (cfg.rt_priority != 0)
+        lock_memory();
+
+    ConfigSwap  configs{ cfg };
+    Stats       stats{};
+    stats.top_devices = cfg.top_devices;
+    StatsServer server{ stats, configs, cfg.stats_socket };
+    if (cfg.bench) {
+        source.print();
+        run_bench(cfg, source, configs, stats, startup);
+        return 0;
+    }
 
-    Raspi raspi{ cfg.led_pins, cfg.invert };
-    UsbMon monitor{};
+    // the pins are set up while the usbmon devices are opened and the config is printed
+    OutputSetup output{ cfg, stats };
+    optional<TraceWriter> trace;    // outlives the capture thread
+    if (!cfg.record_file.empty())
+        trace.emplace(cfg.record_file, stats);
+    UsbMon      monitor{ cfg.usb_buses, cfg.channels, cfg.ring_size, stats };
+    if (trace)
+        monitor.record_to(*trace);
+    CounterSource counters{ cfg.channels, cfg.subscribe_port };
+    optional<RatePublisher> publisher;
+    if (!cfg.publish_target.empty())
+        publisher.emplace(cfg, monitor);
+    startup.usbmon = now();
+    source.print();
+    if (cfg.logging)
+        printf("capture: %s\n", monitor.get_buses().empty() ? "-" : monitor.is_batched() ? "mmap ring" : "read()");
+    monitor.start(cfg.capture_cpu, max(cfg.rt_priority - 1, 0), cfg.busypoll);
+    pin_to_cpu(pthread_self(), cfg.pwm_cpu);
+    make_realtime(cfg.rt_priority);
 
-    generate_led_pwm(cfg, raspi, monitor);
+    Scheduler  scheduler{ stats };
+    Logger     logger{ cfg.logging, stats };
+    optional<ControlServer> control;
+    if (!cfg.control_socket.empty())
+        control.emplace(configs, source, monitor.get_wake_fd());
+    run_output(configs, output, monitor, counters, scheduler, logger, timepoint_t::max(), startup);
     return 0;
 }